@@ -1,5 +1,5 @@
 @echo off
-cl main.c ^
+cl main.c %* ^
 /Fea.exe /Zi /nologo ^
 /link ^
-user32.lib d3d11.lib d3dcompiler.lib dxguid.lib  
\ No newline at end of file
+user32.lib winmm.lib d3d11.lib d3dcompiler.lib dxguid.lib  
\ No newline at end of file
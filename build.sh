@@ -0,0 +1,4 @@
+#!/bin/sh
+# Headless build, frames are drawn by the software renderer. Extra
+# arguments go to gcc, e.g. ./build.sh -DPROFILER
+gcc main.c -o a.out -O2 -g -lm -lpthread "$@"
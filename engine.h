@@ -15,19 +15,187 @@
 #define MAX_INPUT_LAYOUTS 10
 #define MAX_BLEND_STATES 10
 
+#define SOFTWARE_TILE_SIZE 64
+#define SOFTWARE_MAX_PRIMITIVES 8192
+#define SOFTWARE_MAX_TILE_PRIMITIVES 2048
+#define SOFTWARE_MAX_THREADS 32
+#define MAX_GOLDEN_FRAMES 64
+#define MAX_PACK_ENTRIES 64
+#define MAX_LOAD_JOBS 1024
+#define MAX_LOADER_THREADS 32
+
+#define PROFILER_MAX_THREADS 64
+#define PROFILER_EVENTS 65536 // Per thread, power of two
+
+#define MAX_SCENARIOS 32
+#define MAX_SCENARIO_ZONES 32
+#define MAX_SCENARIO_TICKS 100000
+#define MAX_BENCH_RESULTS 128
+#define MAX_BENCH_COUNTS 8
+#define BENCH_MAX_COUNT 4096
+#define COMPARE_MIN_RUNS 5
+#define MAX_TEXT_GLYPHS 1024
+#define MAX_COUNTERS 16
+#define COUNTER_MAX_THREADS 64
+#define COUNTER_BUCKETS 16
+#define CACHE_LINE 64
+#define HUD_HISTORY 120
+#define PERF_COUNTERS 4
+#define HISTOGRAM_SUB_BUCKETS 16 // Per power of two, buckets are at most 6% wide
+#define HISTOGRAM_MAGNITUDES 32 // Microseconds up to 2^35, about 9 hours
+#define HISTOGRAM_WINDOWS 4
+#define HISTOGRAM_WINDOW_SAMPLES 600
+#define BLACKBOX_FRAMES 256
+#define MAX_TELEMETRY_COLUMNS 32
+#define TELEMETRY_NAME 32
+#define TELEMETRY_BUFFER 65536 // Bytes, there are two
+#define MAX_ALLOC_SITES 128
+#define MAX_JOB_WORKERS 32
+#define JOB_DEQUE_SIZE 1024 // Per worker, power of two
+#define MAX_RENDER_ITEMS 16384 // Per snapshot
+#define INPUT_QUEUE_SIZE 256 // Events, power of two
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS) // Per level
+#define TIMER_WHEEL_LEVELS 4 // Up to 2^24 ticks ahead, about 77 hours
+#define PACER_MIN_SPIN_MILLISECONDS 0.25 // Grows to cover the worst recent oversleep
+#define PACER_MAX_SPIN_MILLISECONDS 4.0
+#define PACER_POWER_SAVING_HZ 30.0 // When -power-save is given no -fps
+#define QUEUE_BENCH_ITEMS 4000000
+#define QUEUE_BENCH_CAPACITY 4096
+#define QUEUE_BENCH_BATCH 64
+#define QUEUE_BENCH_PRODUCERS 4
+
+#define TELEMETRY_MAGIC 0x4d4c4554 // "TELM"
+#define TELEMETRY_VERSION 1
+
+#define PACK_MAGIC 0x4b434150 // "PACK"
+#define PACK_VERSION 1
+#define PACK_DEFAULT_FILE "assets.pack"
+
+// HEADLESS builds have no window or D3D device, frames are
+// rendered by the software renderer instead. Always on outside Windows.
+
+#ifndef _WIN32
+#define HEADLESS
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#ifdef _WIN32
 #include <windows.h>
 #include <windowsx.h>
 #include <hidusage.h>
 #include <d3d11_1.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include <assert.h>
 #include <time.h>
 #include <float.h>
 #include <math.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_SIMD
+#include <emmintrin.h>
+#endif
+#ifdef ALLOC_AUDIT
+void* AuditMalloc(size_t Size, const char* File, int Line);
+void* AuditRealloc(void* Pointer, size_t Size, const char* File, int Line);
+void AuditFree(void* Pointer, const char* File, int Line);
+#define STBI_MALLOC(Size) AuditMalloc(Size, __FILE__, __LINE__)
+#define STBI_REALLOC(Pointer, Size) AuditRealloc(Pointer, Size, __FILE__, __LINE__)
+#define STBI_FREE(Pointer) AuditFree(Pointer, __FILE__, __LINE__)
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#ifndef _WIN32
+
+// Stand-ins for the Windows & D3D types the shared code uses
+
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+
+typedef struct ID3D11Buffer ID3D11Buffer;
+typedef struct ID3D11ShaderResourceView ID3D11ShaderResourceView;
+typedef struct ID3D11SamplerState ID3D11SamplerState;
+typedef struct ID3D11VertexShader ID3D11VertexShader;
+typedef struct ID3D11PixelShader ID3D11PixelShader;
+typedef struct ID3D11InputLayout ID3D11InputLayout;
+typedef struct ID3D11BlendState ID3D11BlendState;
+typedef struct ID3D10Blob ID3D10Blob;
+typedef struct { const char* Name; const char* Definition; } D3D_SHADER_MACRO;
+
+enum {
+    D3D11_PRIMITIVE_TOPOLOGY_LINELIST = 2,
+    D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST = 4,
+};
+
+#define GetLastError() ((DWORD)errno)
+#define OutputDebugString(String) fputs((String), stderr)
+#define ARRAYSIZE(Array) (sizeof(Array) / sizeof((Array)[0]))
+
+#endif
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#define CACHE_ALIGNED __declspec(align(CACHE_LINE))
+#else
+#define THREAD_LOCAL __thread
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+#endif
+
+// Profiler zones, compiled out unless PROFILER is defined. Zones nest
+// and must be closed on the thread that opened them.
+
+#ifdef PROFILER
+#define PROFILE_INIT() ProfilerInit()
+#define PROFILE_BEGIN(Name) ProfileEvent(Name, 1)
+#define PROFILE_END() ProfileEvent(NULL, 0)
+#define PROFILE_VALUE(Name, Value) ProfileValue(Name, Value)
+#define PROFILE_WRITE(File) ProfilerWrite(File)
+#else
+#define PROFILE_INIT()
+#define PROFILE_BEGIN(Name)
+#define PROFILE_END()
+#define PROFILE_VALUE(Name, Value)
+#define PROFILE_WRITE(File) 0
+#endif
+
+// Allocation audit, compiled out unless ALLOC_AUDIT is defined. While
+// AllocAudit.Armed every heap allocation & MemoryAlloc() is counted by
+// call site, stb_image's included. Goes after every #include.
+
+#ifdef ALLOC_AUDIT
+void* AuditCalloc(size_t Count, size_t Size, const char* File, int Line);
+void* AuditMemoryAlloc(size_t Size, const char* File, int Line);
+#define malloc(Size) AuditMalloc(Size, __FILE__, __LINE__)
+#define calloc(Count, Size) AuditCalloc(Count, Size, __FILE__, __LINE__)
+#define realloc(Pointer, Size) AuditRealloc(Pointer, Size, __FILE__, __LINE__)
+#define free(Pointer) AuditFree(Pointer, __FILE__, __LINE__)
+#define MemoryAlloc(Size) AuditMemoryAlloc(Size, __FILE__, __LINE__)
+#endif
+
+// Keeps a value the optimizer would otherwise drop as unused
+
+#ifdef _MSC_VER
+#define BENCH_KEEP(Value) (BenchEscape = (void*)&(Value), _ReadWriteBarrier())
+#else
+#define BENCH_KEEP(Value) __asm__ volatile("" : : "r"(&(Value)) : "memory")
+#endif
+
 // Types
 
 enum {
@@ -49,6 +217,8 @@ enum {
     DEFAULT_MESH_RECTANGLE, 
     DEFAULT_MESH_RECTANGLE_UV, 
     DEFAULT_MESH_RECTANGLE_LINES, 
+    DEFAULT_MESH_TEXT, 
+    DEFAULT_MESH_HUD_GRAPH, 
     DEFAULT_MESH_COUNT,
 };
 enum {
@@ -65,7 +235,7 @@ enum {
 
 enum {
     UP, LEFT, DOWN, RIGHT, SPACE, 
-    W, A, S, D, Q, E, P, M, N, R, B, C, T, KEYSAMOUNT
+    W, A, S, D, Q, E, P, M, N, R, B, C, T, H, KEYSAMOUNT
 };
 
 typedef uint32_t u32;
@@ -88,6 +258,15 @@ typedef struct {
     float VOffset;
     float USize;
     float VSize;
+    // Where the texture starts in an atlas, in USize/VSize units
+    float AtlasUOffset;
+    float AtlasVOffset;
+#ifdef HEADLESS
+    // RGBA, sRGB encoded like DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+    unsigned char* Pixels;
+    int Width;
+    int Height;
+#endif
 } texture;
 
 typedef struct {
@@ -130,10 +309,8 @@ typedef struct {
 } constantBufferInfo;
 
 typedef struct {
-    LARGE_INTEGER StartingCount;
-    LARGE_INTEGER EndingCount;
-    LARGE_INTEGER TotalCount;
-    LARGE_INTEGER CountsPerSecond;
+    int64_t Start; // ClockNow()
+    int64_t Elapsed; // Nanoseconds
     double ElapsedMilliSeconds;
 } timer;
 
@@ -149,6 +326,7 @@ typedef struct {
 
 typedef struct {
     v3 Position;
+    v3 Home; // Where R puts it back
     float DragSensitivity;
     float Speed;
 } camera;
@@ -172,6 +350,9 @@ typedef struct {
     ID3D11PixelShader* PixelShader;
     ID3D10Blob* VSBlob;
     ID3D10Blob* PSBlob;
+    // Vertex shader bytecode, from VSBlob or the asset pack
+    const void* VSCode;
+    size_t VSCodeSize;
 } shader;
 
 typedef struct {
@@ -180,6 +361,748 @@ typedef struct {
     // TODO: add more fields https://learn.microsoft.com/en-us/windows/win32/api/d3dcompiler/nf-d3dcompiler-d3dcompilefromfile
 } shaderInfo;
 
+// Texture atlas
+
+typedef struct {
+    int Texture;
+    unsigned char* Pixels;
+    int Width;
+    int Height;
+    int X;
+    int Y;
+    // Loader job + 1 while the image is still decoding
+    int LoadJob;
+} atlasImage;
+
+typedef struct {
+    int X;
+    int Y;
+    int Width;
+} skylineNode;
+
+typedef struct {
+    int Open;
+    atlasImage Images[MAX_TEXTURES];
+    int ImageCount;
+    int Width;
+    int Height;
+    float Occupancy;
+} atlas;
+
+// Asset pack: a header, the entry table, then 16 byte aligned data.
+// Written by PackWrite() in -cook mode, mapped by PackOpen().
+
+enum {
+    PACK_ENTRY_NONE,
+    PACK_ENTRY_TEXTURE,
+    PACK_ENTRY_VERTEX_SHADER,
+    PACK_ENTRY_PIXEL_SHADER,
+};
+
+typedef struct {
+    u32 Magic;
+    u32 Version;
+    u32 EntryCount;
+    u32 Size;
+} packHeader;
+
+typedef struct {
+    char Name[64];
+    u32 Type;
+    u32 Offset;
+    u32 Size;
+    // Texture entries are RGBA8, as stbi_load() returns them
+    u32 Width;
+    u32 Height;
+    u32 Reserved;
+    // FNV-1a of the source file
+    uint64_t Hash;
+} packEntry;
+
+typedef struct {
+    unsigned char* Data;
+    size_t Size;
+    packEntry* Entries;
+    int EntryCount;
+    
+    // Cooking collects what gets loaded
+    int Cooking;
+    packEntry CookEntries[MAX_PACK_ENTRIES];
+    void* CookData[MAX_PACK_ENTRIES];
+    int CookCount;
+} pack;
+
+// What DrawObject() has bound, to skip redundant state changes
+
+typedef struct {
+    ID3D11ShaderResourceView* ShaderResourceView;
+    ID3D11SamplerState* SamplerState;
+    ID3D11InputLayout* InputLayout;
+    int Shader;
+    int Mesh;
+    int PrimitiveTopology;
+    void* TexturePixels;
+} renderState;
+
+typedef struct {
+    int DrawCalls;
+    int TextureBinds;
+    int StateChanges;
+} renderStats;
+
+// Glyphs waiting in DEFAULT_MESH_TEXT, drawn with one call. While a
+// snapshot records they wait in its TextVertices instead.
+
+typedef struct {
+    color Color;
+    int GlyphCount;
+} textBatch;
+
+// HUD
+
+typedef struct {
+    timer Timer;
+    double LastFrame;
+    double FrameTimes[HUD_HISTORY]; // Milliseconds, oldest at FrameIndex
+    int FrameIndex;
+    volatile long Ticks; // Update() calls since the last frame, on the simulation thread under -split
+    int TicksPerFrame;
+    v3 Cursor;
+    v3 Scale;
+} hud;
+
+// What HudBegin() shows of the frames. Frames belong to the render thread,
+// so under -split it leaves a copy each take & the simulation thread picks
+// it up when it publishes.
+typedef struct {
+    double FrameTimes[HUD_HISTORY]; // Milliseconds, oldest at FrameIndex
+    int FrameIndex;
+    int TicksPerFrame;
+    double Percentiles[3]; // p50, p99 & p99.9 of FrameStats.Frames
+    renderStats RenderStats; // The last frame's
+    double FrameMilliseconds; // The last whole frame, for telemetry too
+} hudFrames;
+
+// Frame stats
+
+// Log-linear buckets of microseconds like HdrHistogram, over the last
+// HISTOGRAM_WINDOWS windows of HISTOGRAM_WINDOW_SAMPLES samples so old
+// samples roll out
+typedef struct {
+    uint32_t Counts[HISTOGRAM_WINDOWS][HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_BUCKETS];
+    int Window;
+    int WindowSamples;
+} histogram;
+
+typedef struct {
+    int64_t Start;
+    int64_t End;
+    double Milliseconds;
+    long Counters[MAX_COUNTERS]; // Totals when the frame started
+} blackBoxFrame;
+
+// The last BLACKBOX_FRAMES frames. A frame over Budget dumps the Before
+// frames ahead of it and the After frames following it, with their
+// profiler zones when PROFILER is on.
+typedef struct {
+    double Budget; // Milliseconds, 0 is off
+    int Before;
+    int After;
+    int MaxDumps;
+    int Dumps;
+    blackBoxFrame Frames[BLACKBOX_FRAMES];
+    long FrameCount;
+    long LongFrame; // Waiting for its After frames, -1 when none
+    long* Totals; // Counter totals of the frame being drawn, its snapshot's under -split
+} blackBox;
+
+typedef struct {
+    histogram Frames;
+    histogram Ticks;
+    histogram InputToPhoton; // From reading a tick's input to presenting it
+    histogram InputLatency; // From an input event to the tick that takes it
+    int64_t LastFrame;
+    double FrameMilliseconds; // The last whole frame
+} frameStats;
+
+// Frame pacer
+
+enum {
+    PACER_UNCAPPED,
+    PACER_FIXED, // Sleeps most of the budget & spins the rest
+    PACER_POWER_SAVING, // Only sleeps, frames are late by the wake-up error
+};
+
+typedef struct {
+    int Mode;
+    double Hz;
+    int64_t Budget; // Nanoseconds per frame
+    int64_t Spin; // Stops sleeping this long before the deadline
+    int64_t Deadline; // ClockNow() the next frame is due
+    histogram WakeError; // How much later than asked sleeps returned
+    histogram Lateness; // How much later than the deadline waits returned, overruns included
+    long Frames;
+    long Missed; // Over a whole budget late, the schedule restarted
+} framePacer;
+
+// Threads
+
+typedef void threadProc(void* Data);
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE Handle;
+#else
+    pthread_t Handle;
+#endif
+    threadProc* Proc;
+    void* Data;
+} thread;
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION mutex;
+typedef CONDITION_VARIABLE condition;
+#else
+typedef pthread_mutex_t mutex;
+typedef pthread_cond_t condition;
+#endif
+
+// Render snapshots
+
+// One DrawObject() call, with the texture's uvs at the time. A text batch
+// is one item with its glyphs in the snapshot's TextVertices.
+typedef struct {
+    v3 Position;
+    v3 Scale;
+    float Rotation;
+    color Color;
+    int Mesh;
+    int Texture;
+    int Shader;
+    int ConstantBuffer;
+    int InputLayout;
+    int PrimitiveTopology;
+    float UOffset;
+    float VOffset;
+    float USize;
+    float VSize;
+    int FirstGlyph;
+    int Glyphs; // Uploaded to DEFAULT_MESH_TEXT before drawing when not 0
+} renderItem;
+
+// Everything Draw() drew after a tick, never changed once published
+typedef struct {
+    renderItem Items[MAX_RENDER_ITEMS];
+    int Count;
+    float TextVertices[MAX_TEXT_GLYPHS * 6 * 5];
+    int TextGlyphs;
+    long Tick;
+    int64_t InputTime; // When the tick read its input
+    long Counters[MAX_COUNTERS]; // Totals after the tick
+} renderSnapshot;
+
+// The simulation thread ticks & records Draw() into Snapshots[Writing],
+// then swaps it with Ready. The render thread swaps Ready with Reading
+// when there's a new one. Nobody waits on the other unless Lockstep.
+typedef struct {
+    renderSnapshot Snapshots[3];
+    int Writing;
+    int Ready;
+    int Reading;
+    int Fresh; // Ready hasn't been taken
+    int Lockstep; // Every snapshot is drawn, for deterministic runs
+    int SimulatedTime; // Timer follows the ticks, like seeded runs
+    int Paced; // A tick per DeltaTime of real time, otherwise flat out
+    volatile int64_t Stop; // Atomic, the simulation thread checks it without the mutex
+    int Running; // Between SplitStart() & SplitStop()
+    long Ticks;
+    long Skipped; // Published over before being drawn
+    thread Thread;
+    mutex Mutex;
+    condition Published;
+    condition Taken;
+    hudFrames Frames; // The render thread's as of its last take
+    hudFrames RecordFrames; // Copied from Frames on publish, for the HUD while recording
+} split;
+
+// Jobs
+
+// Runs items Begin to End - 1 of whatever Data is
+typedef void jobProc(int Begin, int End, void* Data);
+
+typedef struct {
+    jobProc* Proc;
+    void* Data;
+    int Begin;
+    int End;
+    int Grain; // Longer ranges are halved, the upper halves can be stolen
+    volatile long* Counter; // Decremented when done
+} job;
+
+// The owning worker pushes & pops at Bottom, the others steal from Top.
+// Both change under Mutex with atomic stores, so JobTake() can skip an
+// empty deque without taking the lock.
+typedef struct {
+    CACHE_ALIGNED mutex Mutex;
+    volatile int64_t Top;
+    volatile int64_t Bottom;
+    job Jobs[JOB_DEQUE_SIZE];
+} jobDeque;
+
+typedef struct {
+    int WorkerCount; // The calling thread included, 1 runs everything inline
+    int Initialized;
+    jobDeque Deques[MAX_JOB_WORKERS];
+    thread Threads[MAX_JOB_WORKERS];
+    volatile long Queued;
+    volatile long Sleeping;
+    int Stop;
+    mutex Mutex;
+    condition WorkReady;
+} jobs;
+
+// Queues
+
+// Bounded ring of fixed size items, one thread pushes & one pops. Each
+// side owns a cache line with its index & a copy of the other's, which
+// it only refreshes when the ring looks full or empty.
+typedef struct {
+    CACHE_ALIGNED volatile int64_t Head; // Next to pop
+    int64_t CachedTail;
+    CACHE_ALIGNED volatile int64_t Tail; // Next to push
+    int64_t CachedHead;
+    CACHE_ALIGNED unsigned char* Items;
+    int ItemSize;
+    int Capacity; // Power of two
+} spscQueue;
+
+// Bounded ring, any thread pushes & one pops. Producers claim slots by
+// moving Tail with a compare & exchange, then publish each one by
+// setting its sequence to position + 1 after the copy, so the consumer
+// takes slots in order even when producers finish out of order.
+typedef struct {
+    CACHE_ALIGNED volatile int64_t Head; // Next to pop
+    CACHE_ALIGNED volatile int64_t Tail; // Next to claim
+    CACHE_ALIGNED volatile int64_t* Sequences;
+    unsigned char* Items;
+    int ItemSize;
+    int Capacity; // Power of two
+} mpscQueue;
+
+// Input events
+
+enum {
+    INPUT_KEY_DOWN,
+    INPUT_KEY_UP,
+    INPUT_MOUSE_DOWN, // Key is 0 for the left button, 1 for the right
+    INPUT_WHEEL, // Key is 1 up, -1 down
+};
+
+typedef struct {
+    int64_t Time; // ClockNow()
+    int Type;
+    int Key;
+    int X;
+    int Y;
+} inputEvent;
+
+// Whoever sees an event pushes it, whoever ticks pops it. A tick takes
+// the events up to its time & keeps the first later one for the next.
+// The thread that renders pops its own copy of them for the camera.
+typedef struct {
+    mpscQueue Events;
+    inputEvent Next;
+    int HasNext;
+    int Down[KEYSAMOUNT]; // As of the last event taken
+    long Dropped; // The queue was full
+    mpscQueue Camera;
+    int CameraDown[KEYSAMOUNT]; // As of the last event HandleCamera() took
+} inputQueue;
+
+// Timer wheel
+
+typedef struct {
+    int64_t Due; // Tick
+    int Kind; // The caller's, e.g. what to do
+    int Data; // The caller's, e.g. an entity index
+    int Next; // In its slot or the free list, 0 ends
+    int Previous;
+    int Level; // -1 when not scheduled
+    int Slot;
+} timerNode;
+
+// One-shot timers due on integer ticks. Level 0 has a slot per tick for
+// the next TIMER_WHEEL_SLOTS ticks, each level up has slots that span a
+// whole lower level. A slot of a level is moved down to the ones below
+// it when the wheel gets to its first tick, so advancing a tick only
+// touches the timers due in it & the ones moving down.
+typedef struct {
+    timerNode* Nodes; // Node 0 is unused, handles are indexes
+    int Capacity;
+    int Free;
+    int Count;
+    int Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // First node, 0 when empty
+    int64_t Now; // The last tick advanced to
+} timerWheel;
+
+// What TimerAdvance() hands back
+typedef struct {
+    int Kind;
+    int Data;
+    int Handle; // Already free
+} timerFired;
+
+// Coroutines
+
+#define COROUTINE_DONE -1
+
+// Stackless, switch based like protothreads, so a coroutine is a few
+// ints rather than a stack. Proc starts with COROUTINE_BEGIN() & ends
+// with COROUTINE_END(), COROUTINE_WAIT() returns from it & it carries on
+// after the wait next time. Locals don't live across waits, keep what
+// needs to in whatever Data points at. One wait per line, & not with
+// MSVC's /ZI, where __LINE__ isn't a constant.
+#define COROUTINE_BEGIN(Coroutine) switch((Coroutine)->Line) { case 0:
+#define COROUTINE_WAIT(Coroutine, Ticks) do { (Coroutine)->Line = __LINE__; return (Ticks); case __LINE__:; } while(0)
+#define COROUTINE_END(Coroutine) } return COROUTINE_DONE
+
+typedef struct coroutine {
+    int (*Proc)(struct coroutine* Coroutine); // Ticks to wait, or COROUTINE_DONE
+    int Data; // The caller's, e.g. an entity index
+    int Line; // Where Proc carries on, 0 is its start
+    int Timer; // In the scheduler's wheel, 0 when not waiting
+    int Next; // In the free list
+} coroutine;
+
+typedef int coroutineProc(coroutine* Coroutine);
+
+// Waiting coroutines are only timers in the wheel, so ticks cost nothing
+// for the ones not due
+typedef struct {
+    coroutine* Coroutines; // 0 is unused, ids are indexes
+    int Capacity;
+    int Free;
+    int Count;
+    timerWheel Wheel;
+} scheduler;
+
+// Counters
+
+// Written only by its own thread, on cache lines of its own
+typedef struct {
+    CACHE_ALIGNED long Values[MAX_COUNTERS];
+} counterThread;
+
+// Per tick counts. Histogram bucket 0 counts ticks with no counts, bucket
+// N ticks with 2^(N-1) to 2^N - 1 of them, the last one everything above.
+typedef struct {
+    int Ticks;
+    long Total[MAX_COUNTERS];
+    long Max[MAX_COUNTERS];
+    int Histogram[MAX_COUNTERS][COUNTER_BUCKETS];
+} counterStats;
+
+typedef struct {
+    const char* Names[MAX_COUNTERS];
+    int Count;
+    counterThread Threads[COUNTER_MAX_THREADS];
+    volatile long ThreadCount;
+    long Tick[MAX_COUNTERS]; // Last tick's counts
+    long Second[MAX_COUNTERS];
+    double Rate[MAX_COUNTERS]; // Per second, over the last whole second
+    double SecondStart;
+    int Log; // Debug() a line with the rates every second
+    counterStats Stats;
+} counters;
+
+// Allocation audit
+
+typedef struct {
+    const char* File;
+    int Line;
+    long Count;
+    long Bytes;
+} allocSite;
+
+typedef struct {
+    int Enabled;
+    int Armed; // Counting, after Init() or inside scenario ticks
+    int Trap; // abort() on the first allocation
+    volatile long Allocations;
+    volatile long Frees;
+    allocSite Sites[MAX_ALLOC_SITES];
+    int SiteCount;
+    mutex Mutex;
+} allocAudit;
+
+// Telemetry
+
+// Followed by one record per tick, an int32_t per column
+typedef struct {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t ColumnCount;
+    char Names[MAX_TELEMETRY_COLUMNS][TELEMETRY_NAME];
+} telemetryHeader;
+
+// Records fill one buffer while the writer thread writes the other. When
+// the writer is still busy with it the tick's record is dropped rather
+// than waiting.
+typedef struct {
+    FILE* File;
+    telemetryHeader Header;
+    int RecordSize;
+    const char* GameNames[MAX_TELEMETRY_COLUMNS];
+    int GameCount;
+    int32_t GameValues[MAX_TELEMETRY_COLUMNS]; // Set by the game each tick
+    unsigned char Buffers[2][TELEMETRY_BUFFER];
+    int Active;
+    int Fill;
+    int Pending; // Bytes of the other buffer for the writer, 0 when it's free
+    int Stop;
+    int Failed;
+    long Tick;
+    long Dropped;
+    thread Thread;
+    mutex Mutex;
+    condition Ready;
+    condition Done;
+} telemetry;
+
+// Benchmarks
+
+typedef void benchProc(int Count);
+
+// Times are nanoseconds per item
+typedef struct {
+    char Name[64];
+    int Count;
+    int Repetitions;
+    double Median;
+    double P99;
+    double Min;
+    double Mean;
+    double* Samples; // Every repetition, sorted
+    double Counters[MAX_COUNTERS]; // Per item
+} benchResult;
+
+typedef struct {
+    int Warmup;
+    int Repetitions;
+    int Counts[MAX_BENCH_COUNTS];
+    int CountCount;
+    char* Filter;
+    benchResult Results[MAX_BENCH_RESULTS];
+    int ResultCount;
+} benchmarks;
+
+// Scenarios
+
+// Called before every tick, pushes its input events
+typedef void scenarioScript(int Tick);
+
+typedef struct {
+    const char* Name;
+    double Milliseconds;
+    double* Samples; // Per tick, in tick order
+    uint64_t Perf[PERF_COUNTERS];
+} scenarioZone;
+
+// Tick times are milliseconds, zones are per tick averages
+typedef struct {
+    char Name[64];
+    int Ticks;
+    double TicksPerSecond;
+    double P50;
+    double P95;
+    double P99;
+    double Max;
+    double* Samples; // Every tick, sorted
+    scenarioZone Zones[MAX_SCENARIO_ZONES];
+    int ZoneCount;
+    counterStats Counters;
+    double EntityTicks; // ScenarioEntities summed over the ticks
+    long Allocations; // During the ticks, ALLOC_AUDIT only
+} scenarioResult;
+
+// Regression gate
+
+enum {
+    JSON_NULL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+};
+
+// Strings point into the parsed text, Key is set for object members
+typedef struct jsonValue {
+    int Type;
+    double Number;
+    char* String;
+    char* Key;
+    struct jsonValue* Items;
+    int Count;
+} jsonValue;
+
+// One timed thing from a results file, e.g. "EntityHitsAsteroid/256" or
+// "stress/Bullets", with the samples of every file given for it and the
+// median of each file on its own
+typedef struct {
+    char Name[128];
+    double* Samples;
+    int Count;
+    double* Runs;
+    int RunCount;
+} compareMetric;
+
+typedef struct {
+    compareMetric* Metrics;
+    int Count;
+} compareSet;
+
+// Profiler
+
+typedef struct {
+    const char* Name;
+    int64_t Time;
+    int Begin;
+    int IsValue; // A sample of a counter track, not a zone
+    double Value;
+    uint64_t Perf[PERF_COUNTERS]; // Only on the thread that opened them
+} profileEvent;
+
+// Ring buffer written only by its own thread. Head counts every event
+// ever written, the last PROFILER_EVENTS of them are kept.
+typedef struct {
+    profileEvent Events[PROFILER_EVENTS];
+    volatile long Head;
+    int Id;
+} profileThread;
+
+typedef struct {
+    profileThread* Threads[PROFILER_MAX_THREADS];
+    volatile long ThreadCount;
+    int64_t StartTime;
+} profiler;
+
+// Hardware counters
+
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+};
+
+// One counter group read with a single read() at every profiler event of
+// the thread that opened it
+typedef struct {
+    int Group; // Leader's descriptor, -1 when closed
+    int Opened[PERF_COUNTERS];
+    int Order[PERF_COUNTERS]; // Counter of each value a read returns
+    int OrderCount;
+    profileThread* Thread;
+} perf;
+
+// Asset loader
+
+enum {
+    LOAD_FREE,
+    LOAD_QUEUED,
+    LOAD_DECODING,
+    LOAD_DECODED,
+};
+
+typedef struct {
+    char File[256];
+    int State;
+    unsigned char* Pixels;
+    int Width;
+    int Height;
+} loadJob;
+
+// Jobs is a ring, job N is in slot N % MAX_LOAD_JOBS & the slot is free
+// again once LoaderTake() hands it out. Everything in it & the counts
+// only change under Mutex.
+typedef struct {
+    loadJob Jobs[MAX_LOAD_JOBS];
+    int JobCount; // Ever queued
+    int NextJob; // The next to decode
+    int DecodedCount;
+    thread Threads[MAX_LOADER_THREADS];
+    int ThreadCount;
+    mutex Mutex;
+    condition WorkReady;
+    condition WorkDone;
+} loader;
+
+// Software renderer
+
+enum {
+    SOFTWARE_PRIMITIVE_TRIANGLE,
+    SOFTWARE_PRIMITIVE_LINE,
+};
+
+typedef struct {
+    int Type;
+    int Shader;
+    int Texture;
+    int Opaque;
+    color Color;
+    u32 PackedColor;
+    // Pixel bounds, inclusive
+    int MinX;
+    int MinY;
+    int MaxX;
+    int MaxY;
+    // Triangles: edge functions E(x, y) = A * x + B * y + C, E >= 0 inside
+    float EdgeA[3];
+    float EdgeB[3];
+    float EdgeC[3];
+    int EdgeTopLeft[3];
+    // Perspective correct attributes, 1/w and uv/w per vertex
+    float InvW[3];
+    float UW[3];
+    float VW[3];
+    // Lines: end points in pixels
+    float X0;
+    float Y0;
+    float X1;
+    float Y1;
+} softwarePrimitive;
+
+typedef struct {
+    u32* Pixels;
+    int Width;
+    int Height;
+    int TilesX;
+    int TilesY;
+    int TileCount;
+    
+    softwarePrimitive* Primitives;
+    int PrimitiveCount;
+    int* TileBins;
+    int* TileBinCounts;
+    
+    float SrgbToLinear[256];
+    float UnormToFloat[256];
+    
+    u32 ClearColor;
+    int ClearPending;
+    
+    // Workers rasterize tiles in parallel, each tile walks its bin in
+    // submission order so blending matches the GPU
+    thread Threads[SOFTWARE_MAX_THREADS];
+    int ThreadCount;
+    mutex Mutex;
+    condition WorkReady;
+    condition WorkDone;
+    int Generation;
+    int WorkersBusy;
+    volatile long NextTile;
+} softwareRenderer;
+
 // Globals
 
 void* MemoryBackend;
@@ -204,10 +1127,76 @@ int ConstantBufferCount;
 // For DrawRectangle(), testing function
 int TestRectangleMesh;
 
+// Textures created between AtlasBegin() and AtlasEnd() share one texture
+atlas Atlas;
+
+// Cooked assets, used instead of the source files when present
+pack Pack;
+
+// Decodes textures on worker threads once LoaderInit() has been called
+loader Loader;
+
+// Microbenchmarks, see BenchRun()
+benchmarks Bench = {
+    .Warmup = 20,
+    .Repetitions = 200,
+    .Counts = {16, 256, 4096},
+    .CountCount = 3,
+};
+void* volatile BenchEscape;
+
+scenarioResult ScenarioResults[MAX_SCENARIOS];
+int ScenarioResultCount;
+
+#ifdef PROFILER
+profiler Profiler;
+THREAD_LOCAL profileThread* ProfileThread;
+#endif
+
+perf Perf = { .Group = -1 };
+const char* PerfNames[PERF_COUNTERS] = {"cycles", "instructions", "cache misses", "branch misses"};
+
+// Live entities, set by the scenario script each tick for per entity figures
+int ScenarioEntities;
+
+counters Counters;
+THREAD_LOCAL counterThread* CounterThread;
+
+telemetry Telemetry;
+
+allocAudit AllocAudit;
+
+jobs Jobs;
+THREAD_LOCAL int JobWorker; // Index of this thread's deque, 0 on the main thread
+
+renderState RenderState;
+renderStats RenderStats;
+renderStats FrameRenderStats;
+textBatch TextBatch;
+hud Hud;
+frameStats FrameStats;
+framePacer Pacer;
+split Split = {
+    .Writing = 0,
+    .Ready = 1,
+    .Reading = 2,
+};
+THREAD_LOCAL renderSnapshot* SnapshotRecording; // Set while the simulation thread runs Draw()
+THREAD_LOCAL renderItem* SnapshotDrawing; // Set while the render thread draws an item of one
+blackBox BlackBox = {
+    .Before = 60,
+    .After = 10,
+    .MaxDumps = 8,
+    .LongFrame = -1,
+    .Totals = Counters.Stats.Total,
+};
+
 float DeltaTime = 1.0f / 60.0f;
+int64_t TickCount; // Ticks run, the one in Update() included
 
 camera Camera = {
     .Position = {0.0f, 0.0f, -14.5f},
+    .Home = {0.0f, 0.0f, -14.5f},
     .DragSensitivity = 0.1f,
     .Speed = 20.0f,
 };
@@ -244,8 +1233,11 @@ color EngineColorGridRed =    {1.0f, 0.05f, 0.05f, 1.0f};
 int MeshTriangle;
 int MeshRectangle;
 
+// Set by InputTick() for each tick. KeyDown is held at the end of the
+// tick or pressed in it, KeyPressed counts the presses in it.
 int KeyDown[KEYSAMOUNT];
 int KeyPressed[KEYSAMOUNT];
+inputQueue InputQueue;
 
 int Running = 1;
 
@@ -256,11 +1248,16 @@ int ClientHeight;
 int ScreenWidth;
 int ScreenHeight;
 
+#ifndef HEADLESS
 D3D11_VIEWPORT Viewport;
 
 ID3D11Device1* Device;
 ID3D11DeviceContext1* Context;
 ID3D11Buffer* Buffer;
+#else
+softwareRenderer SoftwareRenderer;
+int SoftwareThreadCount;
+#endif
 
 matrix ProjectionMatrix;
 matrix ViewMatrix;
@@ -271,6 +1268,12 @@ void Init();
 void Input();
 void Update();
 void Draw();
+// Runs the game's benchmarks with BenchRun()
+void Benchmark();
+// Runs the game's scenarios whose name contains Filter with ScenarioRun()
+void RunScenarios(char* Filter);
+// Times the game's ParallelFor() loops over growing counts & worker counts
+void BenchmarkJobs();
 
 void HandleCamera();
 
@@ -284,24 +1287,154 @@ void DrawObject(v3 Position,
                 int ConstantBuffer,
                 int InputLayout,
                 int PrimitiveTopology);
+int CreateTexture(const char* File, textureInfo* Info, int TextureIndex);
+int CreateShader(const wchar_t* Filename, shaderInfo* Info, int ShaderIndex);
 
-MemoryInit(size_t Size);
-void* MemoryAlloc(size_t Size);
+void MemoryInit(size_t Size);
+void* (MemoryAlloc)(size_t Size);
+void AllocAuditInit(int Trap);
+void AllocAuditRecord(size_t Size, const char* File, int Line);
+void AllocAuditPrint();
 
 int ColorIsZero(color Color);
 
 void DrawString(v3 Position, char* String, color Color, v3 Scale);
+void TextBatchAdd(v3 Position, char* String, color Color, v3 Scale);
+float* TextBatchGlyph();
+void TextBatchFlush();
+void HudFrame();
+void RunTick();
+void FrameBegin();
+void HistogramAdd(histogram* Histogram, double Milliseconds);
+double HistogramPercentile(histogram* Histogram, double Percentile);
+void BlackBoxFrame(int64_t Now);
+int BlackBoxDump(long First, long Last);
+int TelemetryColumn(const char* Name);
+void TelemetrySet(int Column, long Value);
+int TelemetryOpen(const char* File);
+void TelemetryTick(double UpdateMilliseconds);
+void TelemetryClose();
+void TelemetryWriter(void* Data);
+int TelemetryCsv(const char* File, const char* Csv);
+renderItem* SnapshotAdd(v3 Position, v3 Scale, float Rotation, color Color, int Mesh, int Texture,
+                        int Shader, int ConstantBuffer, int InputLayout, int PrimitiveTopology,
+                        float UOffset, float VOffset);
+textureInfo SnapshotUvs(int Texture);
+void SnapshotDraw(renderSnapshot* Snapshot);
+void SplitStart();
+void SplitStop();
+void SplitSimulate(void* Data);
+void SplitPublish();
+renderSnapshot* SplitTake(int Wait);
+void HudFramesCopy(hudFrames* Frames);
+void HudBegin(v3 Position, v3 Scale);
+void HudPrint(color Color, const char* Format, ...);
+void HudEnd();
 
 void GridInit(grid* Grid);
 void GridDraw(grid* Grid);
 
 int CreateMesh(float* Vertices, size_t Size, int Stride, int Offset, int MeshIndex);
+int CreateDynamicMesh(size_t Size, int Stride, int MeshIndex);
 void CreateDefaultMeshes();
 
 int CreateBlendState();
 
+void UploadTexture(texture* Texture, unsigned char* ImageData, int ImageWidth, int ImageHeight);
+void AtlasBegin();
+void AtlasAdd(int Texture, unsigned char* Pixels, int Width, int Height);
+void AtlasEnd();
+void ResetRenderState();
+
+int PackOpen(const char* File);
+void PackClose();
+packEntry* PackFind(const char* Name, int Type);
+const void* PackEntryData(packEntry* Entry);
+int PackContains(const void* Pointer);
+void PackCook(const char* Name, int Type, const void* Data, size_t Size, int Width, int Height, const char* Source);
+int PackWrite(const char* File);
+uint64_t HashBytes(const void* Data, size_t Size, uint64_t Hash);
+uint64_t HashFile(const char* File);
+
+void BenchRun(char* Name, benchProc* Setup, benchProc* Proc);
+void BenchmarkEngine();
+int BenchWrite(const char* File);
+
+void ScenarioRun(char* Name, int Ticks, scenarioScript* Script);
+int ScenarioWrite(const char* File);
+
+void ProfilerInit();
+profileThread* ProfileRegisterThread();
+void ProfileSumZones(long From, long To, scenarioZone* Zones, int* ZoneCount, int MaxZones);
+void ProfileEvent(const char* Name, int Begin);
+void ProfileValue(const char* Name, double Value);
+int ProfilerWrite(const char* File);
+void ProfileWriteEvents(FILE* Handle, int64_t From, int64_t To, int64_t Base, int Written);
+
+int PerfOpen();
+void PerfRead(uint64_t* Values);
+
+int CounterRegister(const char* Name);
+counterThread* CounterRegisterThread();
+void CounterAdd(int Counter, long Value);
+long CounterRead(int Counter);
+void CountersTick();
+void CountersReset();
+void CountersPrint(counterStats* Stats);
+
+void JobsInit(int WorkerCount);
+void JobsShutdown();
+void JobPush(job* Job);
+int JobTake(job* Job);
+void JobExecute(job* Job);
+void JobWait(volatile long* Counter);
+void JobWorkerProc(void* Data);
+void ParallelFor(int Count, int Grain, jobProc* Proc, void* Data);
+
+void SpscInit(spscQueue* Queue, int ItemSize, int Capacity);
+void QueueCopy(unsigned char* Ring, int ItemSize, int Capacity, int64_t Position, unsigned char* Items,
+               int Count, int ToRing);
+int SpscPush(spscQueue* Queue, const void* Items, int Count);
+int SpscPop(spscQueue* Queue, void* Items, int Count);
+void MpscInit(mpscQueue* Queue, int ItemSize, int Capacity);
+int MpscPush(mpscQueue* Queue, const void* Items, int Count);
+int MpscPop(mpscQueue* Queue, void* Items, int Count);
+void QueueBenchProducer(void* Data);
+int BenchmarkQueues();
+
+void InputInit();
+void InputReset();
+int InputPush(inputEvent Event);
+void InputTick(int64_t Until);
+
+void TimerWheelInit(timerWheel* Wheel, int Capacity);
+void TimerWheelReset(timerWheel* Wheel, int64_t Now);
+void TimerLink(timerWheel* Wheel, int Handle);
+int TimerAdd(timerWheel* Wheel, int64_t Due, int Kind, int Data);
+void TimerCancel(timerWheel* Wheel, int Handle);
+int TimerAdvance(timerWheel* Wheel, int64_t Tick, timerFired* Fired, int MaxFired);
+
+void SchedulerInit(scheduler* Scheduler, int Capacity);
+void SchedulerReset(scheduler* Scheduler, int64_t Now);
+int CoroutineStart(scheduler* Scheduler, coroutineProc* Proc, int Data, int64_t Due);
+void CoroutineRestart(scheduler* Scheduler, int Id, int64_t Due);
+void CoroutineStop(scheduler* Scheduler, int Id);
+void CoroutineWaitUntil(scheduler* Scheduler, int Id, int64_t Due);
+int SchedulerAdvance(scheduler* Scheduler, int64_t Tick, int* Due, int MaxDue);
+void CoroutineResume(scheduler* Scheduler, int Id);
+int SchedulerRun(scheduler* Scheduler, int64_t Tick);
+
+void LoaderInit(int ThreadCount);
+int LoaderQueue(const char* File);
+int LoaderDecodeNext();
+void LoaderWait();
+unsigned char* LoaderTake(int Job, int* Width, int* Height);
+void LoaderWorker(void* Data);
+
+#ifndef HEADLESS
 void CreatetInputLayout(shader* Shader, D3D11_INPUT_ELEMENT_DESC* Desc, size_t Size, 
                         int InputLayoutIndex);
+#endif
 
 void CreateDefaultInputLayouts();
 void CreateDefaultShaders();
@@ -312,11 +1445,23 @@ int PickMeshRectangle(int MouseX, int MouseY, v3 Position, mesh* Mesh);
 int RayTriangleIntersect(v3 RayOrigin, v3 RayDirection, triangle* Triangle);
 int RectanglesIntersect(rectangle A, rectangle B);
 
+#ifndef HEADLESS
 int IsRepeat(LPARAM LParam);
+int KeyFromVirtualKey(WPARAM VirtualKey);
+#endif
 
-DWORD InitTimer(timer* Timer);
+int64_t ClockNow();
+double NanosecondsToMilliseconds(int64_t Nanoseconds);
+int64_t MillisecondsToNanoseconds(double Milliseconds);
+int64_t TicksToNanoseconds(int64_t Ticks);
+void InitTimer(timer* Timer);
 void StartTimer(timer* Timer);
 void UpdateTimer(timer* Timer);
+void SetTimer(timer* Timer, int64_t Elapsed);
+int MillisecondsToTicks(double Milliseconds);
+void PacerInit(int Mode, double Hz);
+void PacerWait();
+void PacerPrint();
 
 float GetRandomZeroToOne();
 color GetRandomColor();
@@ -348,10 +1493,45 @@ v3 V3TransformNormal(v3* V, matrix* M);
 v3 MatrixV3Multiply(matrix M, v3 V);
 
 matrix MatrixTranslation(v3 V);
+matrix MatrixRotationZ(float AngleDegrees);
+matrix MatrixScale(v3 V);
 matrix MatrixMultiply(matrix* A, matrix* B);
 
 void MatrixInverse(matrix* Source, matrix* Target);
 
+void InitViewProjection();
+
+void ThreadStart(thread* Thread, threadProc* Proc, void* Data);
+void ThreadJoin(thread* Thread);
+void MutexInit(mutex* Mutex);
+void MutexLock(mutex* Mutex);
+void MutexUnlock(mutex* Mutex);
+void ConditionInit(condition* Condition);
+void ConditionWait(condition* Condition, mutex* Mutex);
+void ConditionBroadcast(condition* Condition);
+void SleepMilliseconds(double Milliseconds);
+long AtomicAdd(volatile long* Value, long Amount);
+int64_t AtomicLoad64(volatile int64_t* Value);
+void AtomicStore64(volatile int64_t* Value, int64_t Amount);
+int AtomicCompareExchange64(volatile int64_t* Value, int64_t Expected, int64_t Desired);
+void ThreadYield();
+int GetProcessorCount();
+
+#ifdef HEADLESS
+void SoftwareRendererInit(int Width, int Height, int ThreadCount);
+void SoftwareRendererClear(color Color);
+void SoftwareRendererDraw(v3 Position, v3 Scale, float Rotation, color Color,
+                          int Mesh, int Texture, int Shader, int PrimitiveTopology);
+void SoftwareRendererFlush();
+void HeadlessUpdate();
+void HeadlessDraw();
+int WritePPM(const char* File, u32* Pixels, int Width, int Height);
+int GoldenCheck(char* Directory, int Frame, int Update, int Tolerance, int MaxDiffPixels);
+int CompareRuns(char* Baseline, char* Current, double Threshold, double Alpha);
+#endif
+
+#ifndef HEADLESS
+
 // Win32
 
 LRESULT CALLBACK 
@@ -383,11 +1563,7 @@ WindowProc(HWND Window, UINT Message, WPARAM WParam, LPARAM LParam) {
         
         case WM_MOUSEWHEEL: {
             int Delta = GET_WHEEL_DELTA_WPARAM(WParam);
-            if(Delta > 0) {
-                Mouse.WheelUp = 1;
-            } else {
-                Mouse.WheelDown = 1;
-            }
+            InputPush((inputEvent){ .Type = INPUT_WHEEL, .Key = (Delta > 0) ? 1 : -1 });
         } break;
         case WM_MBUTTONDOWN:
         case WM_MBUTTONUP: {
@@ -396,91 +1572,30 @@ WindowProc(HWND Window, UINT Message, WPARAM WParam, LPARAM LParam) {
         case WM_LBUTTONDOWN:
         case WM_RBUTTONDOWN: {
             if(!IsRepeat(LParam)) {
-                if(Message == WM_LBUTTONDOWN) {
-                    Mouse.LeftButtonPressed = 1;
-                } else {
-                    Mouse.RightButtonPressed = 1;
-                }
-                Mouse.X = GET_X_LPARAM(LParam);
-                Mouse.Y = GET_Y_LPARAM(LParam);
+                InputPush((inputEvent){
+                    .Type = INPUT_MOUSE_DOWN,
+                    .Key = (Message == WM_LBUTTONDOWN) ? 0 : 1,
+                    .X = GET_X_LPARAM(LParam),
+                    .Y = GET_Y_LPARAM(LParam),
+                });
             }
             
         } break;
         case WM_KEYUP:
         case WM_KEYDOWN: {
-            int IsKeyDown = (Message == WM_KEYDOWN ? 1 : 0);
-            switch(WParam) {
-                case VK_UP: {
-                    KeyDown[UP] = IsKeyDown;
-                } break;
-                case VK_DOWN: {
-                    KeyDown[DOWN] = IsKeyDown;
-                } break;
-                case VK_RIGHT: {
-                    KeyDown[RIGHT] = IsKeyDown;
-                } break;
-                case VK_LEFT: {
-                    KeyDown[LEFT] = IsKeyDown;
-                } break;
-                case 'W': {
-                    KeyDown[W] = IsKeyDown;
-                } break;
-                case 'A': {
-                    KeyDown[A] = IsKeyDown;
-                } break;
-                case 'C': {
-                    KeyDown[C] = IsKeyDown;
-                } break;
-                case 'S': {
-                    KeyDown[S] = IsKeyDown;
-                } break;
-                case 'D': {
-                    KeyDown[D] = IsKeyDown;
-                } break;
-                case 'Q': {
-                    KeyDown[Q] = IsKeyDown;
-                } break;
-                case 'E': {
-                    KeyDown[E] = IsKeyDown;
-                } break;
-                case VK_SPACE: {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[SPACE] = 1;
-                    }
-                } break;
-                case 'P': {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[P] = 1;
-                    } 
-                } break;
-                case 'B': {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[B] = 1;
-                    } 
-                } break;
-                case 'M': {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[M] = 1;
-                    }
-                } break;
-                case 'N': {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[N] = 1;
-                    }
-                } break;
-                case 'R': {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[R] = 1;
-                    }
-                } break;
-                case 'T': {
-                    if(IsKeyDown && !IsRepeat(LParam)) {
-                        KeyPressed[T] = 1;
-                    }
-                } break;
-                case 'O': { 
-                    DestroyWindow(Window); 
-                } break;
+            if(WParam == 'O') {
+                DestroyWindow(Window);
+                break;
+            }
+            
+            // Repeats say nothing new, the key is still down
+            
+            int Key = KeyFromVirtualKey(WParam);
+            if(Key >= 0 && !(Message == WM_KEYDOWN && IsRepeat(LParam))) {
+                InputPush((inputEvent){
+                    .Type = (Message == WM_KEYDOWN) ? INPUT_KEY_DOWN : INPUT_KEY_UP,
+                    .Key = Key,
+                });
             }
         } break;
         case WM_DESTROY: { PostQuitMessage(0); } break;
@@ -496,7 +1611,9 @@ WindowProc(HWND Window, UINT Message, WPARAM WParam, LPARAM LParam) {
 int WINAPI 
 WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CmdLine, int CmdShow) {
     
+    PROFILE_INIT();
     MemoryInit(DEFAULT_MEMORY);
+    InputInit();
     InitTimer(&Timer);
     srand((unsigned int)time(NULL));
     
@@ -632,28 +1749,9 @@ WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CmdLine, int CmdShow) {
         .MaxDepth = 1.0f,
     };
     
-    // Projection matrix
-    
-    float AspectRatio = (float)ClientWidth / (float)ClientHeight;
-    float Height = 1.0f;
-    float Near = 1.0f;
-    float Far = 100.0f;
-    
-    ProjectionMatrix = (matrix){
-        2.0f * Near / AspectRatio, 0.0f, 0.0f, 0.0f, 
-        0.0f, 2.0f * Near / Height, 0.0f, 0.0f, 
-        0.0f, 0.0f, Far / (Far - Near), 1.0f, 
-        0.0f, 0.0f, Near * Far / (Near - Far), 0.0f 
-    };
-    
-    // View matrix
+    // Projection & view matrices
     
-    ViewMatrix = (matrix){
-        1.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        -Camera.Position.X, -Camera.Position.Y, -Camera.Position.Z, 1.0f,
-    };
+    InitViewProjection();
     
     // So we can get raw input data from mouse in WinProc
     
@@ -664,30 +1762,104 @@ WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CmdLine, int CmdShow) {
     Rid[0].hwndTarget = Window;
     RegisterRawInputDevices(Rid, 1, sizeof(Rid[0]));
     
+    // -cook loads everything from the sources & writes the pack
+    
+    if(strstr(CmdLine, "-counters")) Counters.Log = 1;
+    
+    // e.g. -budget 4 dumps frames around any over 4 ms
+    char* Budget = strstr(CmdLine, "-budget ");
+    if(Budget) BlackBox.Budget = atof(Budget + strlen("-budget "));
+    
+    if(strstr(CmdLine, "-cook")) {
+        Pack.Cooking = 1;
+    } else {
+        PackOpen(PACK_DEFAULT_FILE);
+    }
+    
+    LoaderInit(GetProcessorCount());
+    JobsInit(GetProcessorCount());
+    
     // Defaults
     
     CreateDefaultMeshes();
     CreateDefaultShaders();
     CreateDefaultInputLayouts();
     CreateDefaultBlendStates();
-    CreateDefaultTextures();
     
+    AtlasBegin();
+    CreateDefaultTextures();
     Init();
+    AtlasEnd();
     
-    while(Running) {
-        
-        UpdateTimer(&Timer);
-        
-        MSG Message;
-        while(PeekMessage(&Message, NULL, 0, 0, PM_REMOVE)) {
+    if(Pack.Cooking) {
+        return PackWrite(PACK_DEFAULT_FILE) ? 0 : 1;
+    }
+    
+#ifdef ALLOC_AUDIT
+    AllocAuditInit(strstr(CmdLine, "-alloc-trap") != NULL);
+    AllocAudit.Armed = 1;
+#endif
+    
+    // e.g. -telemetry soak.bin
+    char* TelemetryArgument = strstr(CmdLine, "-telemetry ");
+    if(TelemetryArgument) {
+        char File[MAX_PATH];
+        sscanf(TelemetryArgument + strlen("-telemetry "), "%259s", File);
+        TelemetryOpen(File);
+    }
+    
+    // Input() & Update() on a thread of their own, ticking at DeltaTime,
+    // this one only draws the newest snapshot & presents
+    
+    int SplitThreads = (strstr(CmdLine, "-split") != NULL);
+    long DrawnTick = 0;
+    if(SplitThreads) {
+        Split.Paced = 1;
+        SplitStart();
+    }
+    
+    // Vsync unless paced, e.g. -fps 144, -fps 0 for uncapped, -power-save
+    
+    char* Fps = strstr(CmdLine, "-fps ");
+    int PowerSave = (strstr(CmdLine, "-power-save") != NULL);
+    int PresentInterval = (Fps || PowerSave) ? 0 : 1;
+    PacerInit(PowerSave ? PACER_POWER_SAVING : PACER_FIXED, Fps ? atof(Fps + strlen("-fps ")) : 0.0);
+    if(Pacer.Mode != PACER_UNCAPPED) timeBeginPeriod(1);
+    
+    while(Running) {
+        
+        PROFILE_BEGIN("Frame");
+        
+        if(!SplitThreads) UpdateTimer(&Timer);
+        
+        PROFILE_BEGIN("Messages");
+        MSG Message;
+        while(PeekMessage(&Message, NULL, 0, 0, PM_REMOVE)) {
             if(Message.message == WM_QUIT) Running = 0;
             TranslateMessage(&Message);
             DispatchMessage(&Message);
         }
+        PROFILE_END();
         
-        Input();
+        int64_t InputTime = ClockNow();
+        
+        PROFILE_BEGIN("Input");
+        if(!SplitThreads) {
+            InputTick(InputTime);
+            Input();
+        }
         HandleCamera();
-        Update();
+        PROFILE_END();
+        
+        renderSnapshot* Snapshot = NULL;
+        if(SplitThreads) {
+            Snapshot = SplitTake(0);
+            InputTime = Snapshot->InputTime;
+        } else {
+            PROFILE_BEGIN("Update");
+            RunTick();
+            PROFILE_END();
+        }
         
         float ClearColor[] = {EngineColorBackground.R, EngineColorBackground.G, EngineColorBackground.B};
         
@@ -704,15 +1876,505 @@ WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CmdLine, int CmdShow) {
         
         ID3D11DeviceContext1_VSSetConstantBuffers(Context, 0, 1, &ConstantBuffers[0]);
         
-        Draw();
+        PROFILE_BEGIN("Draw");
+        ResetRenderState();
+        FrameBegin();
+        if(Snapshot) {
+            SnapshotDraw(Snapshot);
+        } else {
+            Draw();
+        }
+        PROFILE_END();
         
-        IDXGISwapChain1_Present(SwapChain, 1, 0);
+        PROFILE_BEGIN("Present");
+        IDXGISwapChain1_Present(SwapChain, PresentInterval, 0);
+        PROFILE_END();
         
+        // Only the first present of each tick counts
+        
+        if(!Snapshot || Snapshot->Tick != DrawnTick) {
+            int64_t Presented = ClockNow();
+            HistogramAdd(&FrameStats.InputToPhoton, NanosecondsToMilliseconds(Presented - InputTime));
+            if(Snapshot) DrawnTick = Snapshot->Tick;
+        }
+        
+        PROFILE_BEGIN("Pace");
+        PacerWait();
+        PROFILE_END();
+        
+        PROFILE_END();
     }
     
+    if(SplitThreads) SplitStop();
+    if(Pacer.Mode != PACER_UNCAPPED) {
+        timeEndPeriod(1);
+        PacerPrint();
+    }
+    
+    AllocAudit.Armed = 0;
+    if(AllocAudit.Enabled) AllocAuditPrint();
+    TelemetryClose();
+    PROFILE_WRITE("trace.json");
+    
     return 0;
 }
 
+#else
+
+// Headless
+
+int main(int Argc, char** Argv) {
+    
+    PROFILE_INIT();
+    
+    timer StartupTimer = {0};
+    InitTimer(&StartupTimer);
+    
+    int Frames = 600;
+    char* Screenshot = NULL;
+    SoftwareThreadCount = GetProcessorCount();
+    
+    // Golden images
+    
+    int Seed = -1;
+    char* GoldenDirectory = NULL;
+    int GoldenUpdate = 0;
+    int Tolerance = 2;
+    int MaxDiffPixels = 0;
+    int CaptureFrames[MAX_GOLDEN_FRAMES];
+    int CaptureCount = 0;
+    
+    // Asset pack
+    
+    char* PackFile = PACK_DEFAULT_FILE;
+    int Cook = 0;
+    int LoadBench = 0;
+    char* TraceFile = NULL;
+    char* BenchFile = NULL;
+    char* ScenarioFilter = NULL;
+    char* ScenarioFile = "scenarios.json";
+    int UsePerf = 0;
+    char* CompareBaseline = NULL;
+    char* CompareCurrent = NULL;
+    double CompareThreshold = 0.05;
+    double CompareAlpha = 0.01;
+    char* TelemetryFile = NULL;
+    char* TelemetryInput = NULL;
+    char* TelemetryOutput = NULL;
+    int AllocTrap = 0;
+    int JobWorkers = GetProcessorCount();
+    int JobBench = 0;
+    int QueueBench = 0;
+    int SplitThreads = 0;
+    double PresentMilliseconds = 0.0;
+    double Fps = 0.0;
+    int PowerSave = 0;
+    int HudOnStart = 0;
+    
+    for(int Index = 1; Index < Argc; ++Index) {
+        if(!strcmp(Argv[Index], "-frames") && Index + 1 < Argc) {
+            Frames = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-threads") && Index + 1 < Argc) {
+            SoftwareThreadCount = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-jobs") && Index + 1 < Argc) {
+            JobWorkers = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-job-bench")) {
+            JobBench = 1;
+        } else if(!strcmp(Argv[Index], "-queue-bench")) {
+            QueueBench = 1;
+        } else if(!strcmp(Argv[Index], "-split")) {
+            SplitThreads = 1;
+        } else if(!strcmp(Argv[Index], "-present-ms") && Index + 1 < Argc) {
+            // Stands in for waiting on vsync, e.g. -present-ms 16.7
+            PresentMilliseconds = atof(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-fps") && Index + 1 < Argc) {
+            // Paced, e.g. -fps 144. Flat out otherwise.
+            Fps = atof(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-power-save")) {
+            // Sleeps without spinning, at -fps or PACER_POWER_SAVING_HZ
+            PowerSave = 1;
+        } else if(!strcmp(Argv[Index], "-screenshot") && Index + 1 < Argc) {
+            Screenshot = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-seed") && Index + 1 < Argc) {
+            Seed = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-golden") && Index + 1 < Argc) {
+            GoldenDirectory = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-golden-update")) {
+            GoldenUpdate = 1;
+        } else if(!strcmp(Argv[Index], "-tolerance") && Index + 1 < Argc) {
+            Tolerance = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-max-diff-pixels") && Index + 1 < Argc) {
+            MaxDiffPixels = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-capture") && Index + 1 < Argc) {
+            // e.g. -capture 1,60,300
+            char* List = Argv[++Index];
+            while(*List && CaptureCount < MAX_GOLDEN_FRAMES) {
+                CaptureFrames[CaptureCount++] = atoi(List);
+                while(*List && *List != ',') ++List;
+                if(*List == ',') ++List;
+            }
+        } else if(!strcmp(Argv[Index], "-cook")) {
+            // Writes -pack's file, assets.pack by default
+            Cook = 1;
+        } else if(!strcmp(Argv[Index], "-pack") && Index + 1 < Argc) {
+            PackFile = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-no-pack")) {
+            PackFile = NULL;
+        } else if(!strcmp(Argv[Index], "-load-bench") && Index + 1 < Argc) {
+            LoadBench = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-trace") && Index + 1 < Argc) {
+            TraceFile = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-bench") && Index + 1 < Argc) {
+            BenchFile = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-scenario") && Index + 1 < Argc) {
+            ScenarioFilter = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-scenario-out") && Index + 1 < Argc) {
+            ScenarioFile = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-budget") && Index + 1 < Argc) {
+            BlackBox.Budget = atof(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-perf")) {
+            UsePerf = 1;
+        } else if(!strcmp(Argv[Index], "-counters")) {
+            Counters.Log = 1;
+        } else if(!strcmp(Argv[Index], "-alloc-trap")) {
+            AllocTrap = 1;
+        } else if(!strcmp(Argv[Index], "-hud")) {
+            // Same as pressing H on the first frame
+            HudOnStart = 1;
+        } else if(!strcmp(Argv[Index], "-compare") && Index + 2 < Argc) {
+            // e.g. -compare base.json,base2.json current.json
+            CompareBaseline = Argv[++Index];
+            CompareCurrent = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-telemetry") && Index + 1 < Argc) {
+            TelemetryFile = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-telemetry-csv") && Index + 2 < Argc) {
+            // e.g. -telemetry-csv soak.bin soak.csv
+            TelemetryInput = Argv[++Index];
+            TelemetryOutput = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-threshold") && Index + 1 < Argc) {
+            CompareThreshold = atof(Argv[++Index]) / 100.0;
+        } else if(!strcmp(Argv[Index], "-alpha") && Index + 1 < Argc) {
+            CompareAlpha = atof(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-bench-filter") && Index + 1 < Argc) {
+            Bench.Filter = Argv[++Index];
+        } else if(!strcmp(Argv[Index], "-bench-reps") && Index + 1 < Argc) {
+            Bench.Repetitions = atoi(Argv[++Index]);
+        } else if(!strcmp(Argv[Index], "-bench-counts") && Index + 1 < Argc) {
+            // e.g. -bench-counts 16,256,4096
+            char* List = Argv[++Index];
+            Bench.CountCount = 0;
+            while(*List && Bench.CountCount < MAX_BENCH_COUNTS) {
+                Bench.Counts[Bench.CountCount++] = atoi(List);
+                while(*List && *List != ',') ++List;
+                if(*List == ',') ++List;
+            }
+        }
+    }
+    
+    // Only reads results files, no need for the game
+    
+    if(CompareBaseline) {
+        return (CompareRuns(CompareBaseline, CompareCurrent, CompareThreshold, CompareAlpha) == 0) ? 0 : 1;
+    }
+    
+    if(TelemetryInput) {
+        return TelemetryCsv(TelemetryInput, TelemetryOutput) ? 0 : 1;
+    }
+    
+    // Hardware counters around profiler zones, when the system has them
+    
+    if(UsePerf && !PerfOpen()) {
+        Debug("-perf: no hardware counters (needs PROFILER and a PMU), carrying on without\n");
+    }
+    
+    // Golden runs replay the same ticks every time
+    
+    if(GoldenDirectory && Seed < 0) Seed = 1;
+    if(GoldenDirectory && CaptureCount == 0) CaptureFrames[CaptureCount++] = Frames;
+    
+    MemoryInit(DEFAULT_MEMORY);
+    InputInit();
+    InitTimer(&Timer);
+    srand((Seed >= 0) ? (unsigned int)Seed : (unsigned int)time(NULL));
+    
+    if(HudOnStart) {
+        InputPush((inputEvent){ .Type = INPUT_KEY_DOWN, .Key = H });
+        InputPush((inputEvent){ .Type = INPUT_KEY_UP, .Key = H });
+    }
+    
+    ClientWidth = WindowWidth;
+    ClientHeight = WindowHeight;
+    
+    SoftwareRendererInit(ClientWidth, ClientHeight, SoftwareThreadCount);
+    InitViewProjection();
+    
+    if(Cook) {
+        Pack.Cooking = 1;
+    } else if(PackFile) {
+        PackOpen(PackFile);
+    }
+    
+    LoaderInit(SoftwareThreadCount);
+    JobsInit(JobWorkers);
+    
+    // Decodes every PNG LoadBench times with the loader's threads
+    
+    if(LoadBench > 0) {
+        char* Files[] = {"font_64_64.png", "player.png", "saucer.png"};
+        int Count = LoadBench * ARRAYSIZE(Files);
+        assert(Count <= MAX_LOAD_JOBS);
+        
+        timer LoadTimer = {0};
+        InitTimer(&LoadTimer);
+        
+        int First = 0;
+        for(int Index = 0; Index < Count; ++Index) {
+            int Job = LoaderQueue(Files[Index % ARRAYSIZE(Files)]);
+            if(Index == 0) First = Job;
+        }
+        LoaderWait();
+        
+        UpdateTimer(&LoadTimer);
+        
+        for(int Index = 0; Index < Count; ++Index) {
+            int Width;
+            int Height;
+            free(LoaderTake(First + Index, &Width, &Height));
+        }
+        
+        Debug("load-bench: %d images, %d threads, %.3f ms\n", 
+              Count, Loader.ThreadCount, LoadTimer.ElapsedMilliSeconds);
+        return 0;
+    }
+    
+    // Defaults
+    
+    CreateDefaultMeshes();
+    CreateDefaultShaders();
+    CreateDefaultInputLayouts();
+    CreateDefaultBlendStates();
+    
+    AtlasBegin();
+    CreateDefaultTextures();
+    Init();
+    AtlasEnd();
+    
+    if(Cook) {
+        return PackWrite(PackFile ? PackFile : PACK_DEFAULT_FILE) ? 0 : 1;
+    }
+    
+    if(JobBench) {
+        BenchmarkJobs();
+        return 0;
+    }
+    
+    if(QueueBench) {
+        return BenchmarkQueues() ? 0 : 1;
+    }
+    
+    if(BenchFile) {
+        if(Bench.Repetitions < 1) Bench.Repetitions = 1;
+        BenchmarkEngine();
+        Benchmark();
+        return BenchWrite(BenchFile) ? 0 : 1;
+    }
+    
+    // Benchmarks allocate on purpose, everything from here on shouldn't
+    
+#ifdef ALLOC_AUDIT
+    AllocAuditInit(AllocTrap);
+#else
+    if(AllocTrap) Debug("-alloc-trap needs a build with ALLOC_AUDIT defined\n");
+#endif
+    
+    if(ScenarioFilter) {
+        RunScenarios(strcmp(ScenarioFilter, "all") ? ScenarioFilter : "");
+        
+        int Allocating = 0;
+        for(int Index = 0; Index < ScenarioResultCount; ++Index) {
+            if(ScenarioResults[Index].Allocations) ++Allocating;
+        }
+        if(Allocating) {
+            Debug("%d scenarios allocated in their ticks\n", Allocating);
+            AllocAuditPrint();
+        }
+        
+        return (ScenarioWrite(ScenarioFile) && !Allocating) ? 0 : 1;
+    }
+    
+    UpdateTimer(&StartupTimer);
+    Debug("startup: %.3f ms (%s)\n", StartupTimer.ElapsedMilliSeconds,
+          Pack.Data ? "pack" : "sources");
+    
+    timer FrameTimer = {0};
+    InitTimer(&FrameTimer);
+    double DrawMilliSeconds = 0.0;
+    int DrawCalls = 0;
+    int TextureBinds = 0;
+    int StateChanges = 0;
+    
+    FILE* Timings = NULL;
+    if(GoldenDirectory) {
+        char File[512];
+        snprintf(File, sizeof(File), "%s/timings.csv", GoldenDirectory);
+        Timings = fopen(File, "w");
+        if(Timings) fprintf(Timings, "frame,update_ms,draw_ms\n");
+    }
+    
+    int Failures = 0;
+    
+    if(TelemetryFile) TelemetryOpen(TelemetryFile);
+    AllocAudit.Armed = AllocAudit.Enabled;
+    
+    // Seeded runs draw every tick in lockstep so goldens hold with -split,
+    // others tick at DeltaTime & draw whatever is newest
+    
+    if(SplitThreads) {
+        Split.Lockstep = (Seed >= 0);
+        Split.SimulatedTime = (Seed >= 0);
+        Split.Paced = (Seed < 0);
+        SplitStart();
+    }
+    
+    PacerInit(PowerSave ? PACER_POWER_SAVING : PACER_FIXED, Fps);
+    
+    int Frame = 0;
+    for(; Frame < Frames && Running; ++Frame) {
+        
+        // Seeded runs use simulated time so saucer timers replay too, the
+        // simulation thread keeps its own
+        
+        if(!SplitThreads && Seed >= 0) {
+            SetTimer(&Timer, TicksToNanoseconds(Frame + 1));
+        } else if(!SplitThreads) {
+            UpdateTimer(&Timer);
+        }
+        
+        PROFILE_BEGIN("Frame");
+        
+        UpdateTimer(&FrameTimer);
+        double UpdateStart = FrameTimer.ElapsedMilliSeconds;
+        
+        int64_t InputTime = ClockNow();
+        
+        renderSnapshot* Snapshot = NULL;
+        if(SplitThreads) {
+            PROFILE_BEGIN("Input");
+            HandleCamera();
+            PROFILE_END();
+            
+            PROFILE_BEGIN("Take");
+            Snapshot = SplitTake(1);
+            InputTime = Snapshot->InputTime;
+            PROFILE_END();
+        } else {
+            HeadlessUpdate();
+        }
+        
+        UpdateTimer(&FrameTimer);
+        double DrawStart = FrameTimer.ElapsedMilliSeconds;
+        
+        if(Snapshot) {
+            PROFILE_BEGIN("Draw");
+            SoftwareRendererClear(EngineColorBackground);
+            ResetRenderState();
+            FrameBegin();
+            SnapshotDraw(Snapshot);
+            PROFILE_END();
+            
+            PROFILE_BEGIN("Flush");
+            SoftwareRendererFlush();
+            PROFILE_END();
+        } else {
+            HeadlessDraw();
+        }
+        
+        UpdateTimer(&FrameTimer);
+        DrawMilliSeconds += FrameTimer.ElapsedMilliSeconds - DrawStart;
+        DrawCalls += RenderStats.DrawCalls;
+        TextureBinds += RenderStats.TextureBinds;
+        StateChanges += RenderStats.StateChanges;
+        
+        if(Timings) {
+            fprintf(Timings, "%d,%.4f,%.4f\n", Frame + 1,
+                    DrawStart - UpdateStart,
+                    FrameTimer.ElapsedMilliSeconds - DrawStart);
+        }
+        
+        for(int Index = 0; Index < CaptureCount && GoldenDirectory; ++Index) {
+            if(CaptureFrames[Index] == Frame + 1 &&
+               !GoldenCheck(GoldenDirectory, Frame + 1, GoldenUpdate, Tolerance, MaxDiffPixels)) {
+                ++Failures;
+            }
+        }
+        
+        PROFILE_BEGIN("Present");
+        SleepMilliseconds(PresentMilliseconds);
+        PROFILE_END();
+        
+        int64_t Presented = ClockNow();
+        HistogramAdd(&FrameStats.InputToPhoton, NanosecondsToMilliseconds(Presented - InputTime));
+        
+        PROFILE_BEGIN("Pace");
+        PacerWait();
+        PROFILE_END();
+        
+        PROFILE_END();
+    }
+    
+    if(SplitThreads) SplitStop();
+    AllocAudit.Armed = 0;
+    if(Timings) fclose(Timings);
+    TelemetryClose();
+    
+    if(TraceFile && !PROFILE_WRITE(TraceFile)) {
+        Debug("-trace needs a build with PROFILER defined\n");
+    }
+    
+    if(Screenshot) {
+        WritePPM(Screenshot, SoftwareRenderer.Pixels, SoftwareRenderer.Width, SoftwareRenderer.Height);
+    }
+    
+    UpdateTimer(&FrameTimer);
+    Debug("%d frames, %d threads, %.3f ms/frame, %.3f ms/draw (%.0f fps)\n",
+          Frame, SoftwareRenderer.ThreadCount,
+          FrameTimer.ElapsedMilliSeconds / Frame,
+          DrawMilliSeconds / Frame,
+          Frame * 1000.0 / DrawMilliSeconds);
+    Debug("%.1f draw calls, %.1f texture binds, %.1f state changes per frame\n",
+          (float)DrawCalls / Frame, (float)TextureBinds / Frame, (float)StateChanges / Frame);
+    
+    Debug("frame p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f ms, tick p50 %.3f p99 %.3f p99.9 %.3f ms (last %d)\n",
+          HistogramPercentile(&FrameStats.Frames, 50.0), HistogramPercentile(&FrameStats.Frames, 90.0),
+          HistogramPercentile(&FrameStats.Frames, 99.0), HistogramPercentile(&FrameStats.Frames, 99.9),
+          HistogramPercentile(&FrameStats.Ticks, 50.0), HistogramPercentile(&FrameStats.Ticks, 99.0),
+          HistogramPercentile(&FrameStats.Ticks, 99.9), HISTOGRAM_WINDOWS * HISTOGRAM_WINDOW_SAMPLES);
+    Debug("input to photon p50 %.3f p99 %.3f ms, event to tick p50 %.3f p99 %.3f ms\n",
+          HistogramPercentile(&FrameStats.InputToPhoton, 50.0),
+          HistogramPercentile(&FrameStats.InputToPhoton, 99.0),
+          HistogramPercentile(&FrameStats.InputLatency, 50.0),
+          HistogramPercentile(&FrameStats.InputLatency, 99.0));
+    if(SplitThreads) {
+        Debug("split: %ld ticks, %d frames, %ld snapshots never drawn\n", Split.Ticks, Frame, Split.Skipped);
+    }
+    if(Pacer.Mode != PACER_UNCAPPED) PacerPrint();
+    
+    if(Counters.Log) {
+        Debug("counters:\n");
+        CountersPrint(&Counters.Stats);
+    }
+    
+    if(AllocAudit.Enabled) AllocAuditPrint();
+    
+    if(GoldenDirectory && !GoldenUpdate) {
+        Debug("golden: %d of %d frames failed\n", Failures, CaptureCount);
+    }
+    
+    return Failures ? 1 : 0;
+}
+
+#endif
+
 // dx11
 
 void CreateDefaultTextures() {
@@ -735,6 +2397,8 @@ void CreateDefaultShaders() {
     CreateShader(L"default_shaders_position_uv_atlas.hlsl", NULL, DEFAULT_SHADER_POSITION_UV_ATLAS);
 }
 
+#ifndef HEADLESS
+
 void CreateDefaultInputLayouts() {
     
     {
@@ -749,10 +2413,8 @@ void CreateDefaultInputLayouts() {
             },
         };
         
-        shader TempShader = {0};
-        CreateShaderDiscard(L"dummy_shaders_position.hlsl", NULL, &TempShader);
-        
-        CreateInputLayout(&TempShader, InputElementDesc, ARRAYSIZE(InputElementDesc),
+        CreateInputLayout(&Shaders[DEFAULT_SHADER_POSITION], 
+                          InputElementDesc, ARRAYSIZE(InputElementDesc),
                           DEFAULT_INPUT_LAYOUT_POSITION);
     }
     
@@ -774,10 +2436,8 @@ void CreateDefaultInputLayouts() {
             },
         };
         
-        shader TempShader = {0};
-        CreateShaderDiscard(L"dummy_shaders_position_uv.hlsl", NULL, &TempShader);
-        
-        CreateInputLayout(&TempShader, InputElementDesc, ARRAYSIZE(InputElementDesc),
+        CreateInputLayout(&Shaders[DEFAULT_SHADER_POSITION_UV], 
+                          InputElementDesc, ARRAYSIZE(InputElementDesc),
                           DEFAULT_INPUT_LAYOUT_POSITION_UV);
     }
 }
@@ -799,6 +2459,20 @@ int CreateConstantBuffer(size_t Size, constantBufferInfo* Info) {
     return ConstantBufferCount-1;
 }
 
+#else
+
+// Input layouts & constant buffers are implied by the shader in
+// the software renderer
+
+void CreateDefaultInputLayouts() {
+}
+
+int CreateConstantBuffer(size_t Size, constantBufferInfo* Info) {
+    return ConstantBufferCount++;
+}
+
+#endif
+
 
 // Returns index to Textures array
 int CreateTexture(const char* File, textureInfo* Info, int TextureIndex) {
@@ -817,18 +2491,62 @@ int CreateTexture(const char* File, textureInfo* Info, int TextureIndex) {
         Texture->VSize = Info->VSize;
     }
     
-    // Load image
+    // Load image, cooked pixels are used in place from the pack
     
     int ImageWidth;
     int ImageHeight;
     int ImageChannels;
     int ImageDesiredChannels = 4;
+    unsigned char* ImageData;
+    
+    packEntry* Entry = PackFind(File, PACK_ENTRY_TEXTURE);
+    
+    if(Entry) {
+        ImageData = (unsigned char*)PackEntryData(Entry);
+        ImageWidth = Entry->Width;
+        ImageHeight = Entry->Height;
+    } else if(Loader.ThreadCount && Atlas.Open && !Pack.Cooking) {
+        
+        // Decoded in the background with the rest of the atlas, which
+        // waits for them in AtlasEnd()
+        
+        int Job = LoaderQueue(File);
+        AtlasAdd(Index, NULL, 0, 0);
+        Atlas.Images[Atlas.ImageCount - 1].LoadJob = Job + 1;
+        return Index;
+    } else {
+        ImageData = stbi_load(File,
+                              &ImageWidth, 
+                              &ImageHeight, 
+                              &ImageChannels, ImageDesiredChannels);
+        assert(ImageData);
+        
+        if(Pack.Cooking) {
+            PackCook(File, PACK_ENTRY_TEXTURE, ImageData, ImageWidth * ImageHeight * 4,
+                     ImageWidth, ImageHeight, File);
+        }
+    }
+    
+    // Packed later by AtlasEnd()
+    
+    if(Atlas.Open) {
+        AtlasAdd(Index, ImageData, ImageWidth, ImageHeight);
+        return Index;
+    }
+    
+    UploadTexture(Texture, ImageData, ImageWidth, ImageHeight);
+    
+#ifndef HEADLESS
+    if(!PackContains(ImageData)) free(ImageData);
+#endif
+    
+    return Index;
+}
+
+// Creates the GPU texture, shader resource view & sampler for RGBA pixels
+void UploadTexture(texture* Texture, unsigned char* ImageData, int ImageWidth, int ImageHeight) {
     
-    unsigned char* ImageData = stbi_load(File,
-                                         &ImageWidth, 
-                                         &ImageHeight, 
-                                         &ImageChannels, ImageDesiredChannels);
-    assert(ImageData);
+#ifndef HEADLESS
     
     int ImagePitch = ImageWidth * 4;
     
@@ -859,8 +2577,6 @@ int CreateTexture(const char* File, textureInfo* Info, int TextureIndex) {
                                                    );
     assert(SUCCEEDED(Result));
     
-    free(ImageData);
-    
     // Shader resource view
     
     Result = ID3D11Device1_CreateShaderResourceView(Device,
@@ -893,7 +2609,207 @@ int CreateTexture(const char* File, textureInfo* Info, int TextureIndex) {
                                               &Texture->SamplerState);
     assert(SUCCEEDED(Result));
     
-    return Index;
+#else
+    
+    // The software renderer samples straight from the decoded image
+    
+    Texture->Pixels = ImageData;
+    Texture->Width = ImageWidth;
+    Texture->Height = ImageHeight;
+    
+#endif
+}
+
+// Texture atlas
+
+void AtlasBegin() {
+    Atlas.Open = 1;
+    Atlas.ImageCount = 0;
+}
+
+void AtlasAdd(int Texture, unsigned char* Pixels, int Width, int Height) {
+    assert(Atlas.ImageCount < MAX_TEXTURES);
+    Atlas.Images[Atlas.ImageCount++] = (atlasImage){
+        .Texture = Texture,
+        .Pixels = Pixels,
+        .Width = Width,
+        .Height = Height,
+    };
+}
+
+// Skyline bottom-left packing. Returns 0 if something doesn't fit.
+int AtlasPack(int Width, int Height) {
+    
+    skylineNode Skyline[MAX_TEXTURES * 2 + 1];
+    int NodeCount = 1;
+    Skyline[0] = (skylineNode){0, 0, Width};
+    
+    for(int ImageIndex = 0; ImageIndex < Atlas.ImageCount; ++ImageIndex) {
+        atlasImage* Image = &Atlas.Images[ImageIndex];
+        
+        // Find the node where the image sits lowest
+        
+        int BestNode = -1;
+        int BestX = 0;
+        int BestY = INT32_MAX;
+        
+        for(int Node = 0; Node < NodeCount; ++Node) {
+            int X = Skyline[Node].X;
+            if(X + Image->Width > Width) break;
+            int Y = 0;
+            int Remaining = Image->Width;
+            for(int Span = Node; Remaining > 0; ++Span) {
+                if(Skyline[Span].Y > Y) Y = Skyline[Span].Y;
+                Remaining -= Skyline[Span].Width;
+            }
+            if(Y + Image->Height <= Height && Y < BestY) {
+                BestNode = Node;
+                BestX = X;
+                BestY = Y;
+            }
+        }
+        
+        if(BestNode < 0) return 0;
+        
+        Image->X = BestX;
+        Image->Y = BestY;
+        
+        // Raise the skyline under the image
+        
+        skylineNode Raised = {BestX, BestY + Image->Height, Image->Width};
+        int Right = BestX + Image->Width;
+        int Last = BestNode;
+        while(Last < NodeCount && Skyline[Last].X + Skyline[Last].Width <= Right) ++Last;
+        
+        skylineNode Rest = {0};
+        int HasRest = (Last < NodeCount);
+        if(HasRest) {
+            Rest = Skyline[Last];
+            Rest.Width -= Right - Rest.X;
+            Rest.X = Right;
+            ++Last;
+        }
+        
+        int Inserted = 1 + HasRest;
+        int Removed = Last - BestNode;
+        memmove(&Skyline[BestNode + Inserted], &Skyline[Last], (NodeCount - Last) * sizeof(skylineNode));
+        NodeCount += Inserted - Removed;
+        Skyline[BestNode] = Raised;
+        if(HasRest) Skyline[BestNode + 1] = Rest;
+    }
+    
+    return 1;
+}
+
+// Packs every image added since AtlasBegin() into one texture and points
+// the textures at their rectangles. Images get a one pixel border
+// copied from their edges so linear filtering behaves like clamping.
+void AtlasEnd() {
+    
+    Atlas.Open = 0;
+    if(Atlas.ImageCount == 0) return;
+    
+    // Images still decoding
+    
+    for(int Index = 0; Index < Atlas.ImageCount; ++Index) {
+        atlasImage* Image = &Atlas.Images[Index];
+        if(Image->LoadJob) {
+            LoaderWait();
+            Image->Pixels = LoaderTake(Image->LoadJob - 1, &Image->Width, &Image->Height);
+            Image->LoadJob = 0;
+        }
+    }
+    
+    // Tallest first
+    
+    for(int I = 1; I < Atlas.ImageCount; ++I) {
+        for(int J = I; J > 0 && Atlas.Images[J].Height > Atlas.Images[J - 1].Height; --J) {
+            atlasImage Temp = Atlas.Images[J];
+            Atlas.Images[J] = Atlas.Images[J - 1];
+            Atlas.Images[J - 1] = Temp;
+        }
+    }
+    
+    // Pack with borders into a space one pixel larger on each side, 
+    // borders outside the atlas are dropped since the sampler clamps there
+    
+    for(int Index = 0; Index < Atlas.ImageCount; ++Index) {
+        Atlas.Images[Index].Width += 2;
+        Atlas.Images[Index].Height += 2;
+    }
+    
+    int Width = 256;
+    int Height = 256;
+    while(!AtlasPack(Width + 2, Height + 2)) {
+        if(Width <= Height) Width *= 2; else Height *= 2;
+        assert(Width <= 16384);
+    }
+    
+    unsigned char* Pixels = calloc(Width * Height, 4);
+    int UsedPixels = 0;
+    
+    for(int Index = 0; Index < Atlas.ImageCount; ++Index) {
+        atlasImage* Image = &Atlas.Images[Index];
+        Image->Width -= 2;
+        Image->Height -= 2;
+        UsedPixels += Image->Width * Image->Height;
+        
+        // Packed X, Y is where the border starts, which is also where the
+        // image starts in the atlas
+        
+        for(int Y = -1; Y <= Image->Height; ++Y) {
+            int AtlasY = Image->Y + Y;
+            if(AtlasY < 0 || AtlasY >= Height) continue;
+            int SourceY = (Y < 0) ? 0 : (Y >= Image->Height) ? Image->Height - 1 : Y;
+            for(int X = -1; X <= Image->Width; ++X) {
+                int AtlasX = Image->X + X;
+                if(AtlasX < 0 || AtlasX >= Width) continue;
+                int SourceX = (X < 0) ? 0 : (X >= Image->Width) ? Image->Width - 1 : X;
+                memcpy(&Pixels[(AtlasY * Width + AtlasX) * 4],
+                       &Image->Pixels[(SourceY * Image->Width + SourceX) * 4], 4);
+            }
+        }
+        
+        if(!PackContains(Image->Pixels)) free(Image->Pixels);
+        
+        // The shaders compute uv * Size + Offset * Size, keep that and
+        // move the offset to the image's rectangle
+        
+        texture* Texture = &Textures[Image->Texture];
+        float USize = Texture->USize * (float)Image->Width / (float)Width;
+        float VSize = Texture->VSize * (float)Image->Height / (float)Height;
+        Texture->AtlasUOffset = (float)Image->X / USize / (float)Width;
+        Texture->AtlasVOffset = (float)Image->Y / VSize / (float)Height;
+        Texture->UOffset += Texture->AtlasUOffset;
+        Texture->VOffset += Texture->AtlasVOffset;
+        Texture->USize = USize;
+        Texture->VSize = VSize;
+    }
+    
+    texture* First = &Textures[Atlas.Images[0].Texture];
+    UploadTexture(First, Pixels, Width, Height);
+    
+    for(int Index = 1; Index < Atlas.ImageCount; ++Index) {
+        texture* Texture = &Textures[Atlas.Images[Index].Texture];
+        Texture->ShaderResourceView = First->ShaderResourceView;
+        Texture->SamplerState = First->SamplerState;
+#ifdef HEADLESS
+        Texture->Pixels = First->Pixels;
+        Texture->Width = First->Width;
+        Texture->Height = First->Height;
+#endif
+    }
+    
+#ifndef HEADLESS
+    free(Pixels);
+#endif
+    
+    Atlas.Width = Width;
+    Atlas.Height = Height;
+    Atlas.Occupancy = (float)UsedPixels / (float)(Width * Height);
+    
+    Debug("Atlas: %d textures in %dx%d, %.1f%% occupied\n",
+          Atlas.ImageCount, Width, Height, Atlas.Occupancy * 100.0f);
 }
 
 int CreateMesh(float* Vertices, size_t Size, int StrideInt, int Offset, int MeshIndex) {
@@ -908,6 +2824,7 @@ int CreateMesh(float* Vertices, size_t Size, int StrideInt, int Offset, int Mesh
     Mesh->Vertices = MemoryAlloc(Size);
     memcpy(Mesh->Vertices, Vertices, Size);
     
+#ifndef HEADLESS
     D3D11_BUFFER_DESC BufferDesc = {
         Size,
         D3D11_USAGE_DEFAULT,
@@ -921,21 +2838,64 @@ int CreateMesh(float* Vertices, size_t Size, int StrideInt, int Offset, int Mesh
                                &BufferDesc,
                                &InitialData,
                                &Mesh->Buffer);
+#endif
     return Index;
 }
 
-void CreateDefaultMeshes() {
+// Vertices are rewritten every frame, upload them with MeshUpload()
+int CreateDynamicMesh(size_t Size, int StrideInt, int MeshIndex) {
     
-    // Triangle 
+    int Index = MeshIndex;
+    if(Index == 0) Index = MeshCount++;
+    mesh* Mesh = &Meshes[Index];
     
-    float TriangleVertexData[] = {
-        -0.5f, -0.5f, 0.0f,
-        0.0f,  0.5f, 0.0f,
-        0.5f, -0.5f, 0.0f,
+    Mesh->Stride = StrideInt * sizeof(float);
+    Mesh->NumVertices = 0;
+    Mesh->Offset = 0;
+    Mesh->Vertices = MemoryAlloc(Size);
+    
+#ifndef HEADLESS
+    D3D11_BUFFER_DESC BufferDesc = {
+        Size,
+        D3D11_USAGE_DYNAMIC,
+        D3D11_BIND_VERTEX_BUFFER,
+        D3D11_CPU_ACCESS_WRITE, 0, 0
     };
     
-    CreateMesh(TriangleVertexData, sizeof(TriangleVertexData),
-               3, 0, DEFAULT_MESH_TRIANGLE);
+    ID3D11Device1_CreateBuffer(Device,
+                               &BufferDesc,
+                               NULL,
+                               &Mesh->Buffer);
+#endif
+    return Index;
+}
+
+// Sends the first NumVertices vertices of a dynamic mesh to the GPU
+void MeshUpload(int MeshIndex, int NumVertices) {
+    
+    mesh* Mesh = &Meshes[MeshIndex];
+    Mesh->NumVertices = NumVertices;
+    
+#ifndef HEADLESS
+    D3D11_MAPPED_SUBRESOURCE MappedSubresource;
+    ID3D11DeviceContext1_Map(Context, (ID3D11Resource*)Mesh->Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedSubresource);
+    memcpy(MappedSubresource.pData, Mesh->Vertices, NumVertices * Mesh->Stride);
+    ID3D11DeviceContext1_Unmap(Context, (ID3D11Resource*)Mesh->Buffer, 0);
+#endif
+}
+
+void CreateDefaultMeshes() {
+    
+    // Triangle 
+    
+    float TriangleVertexData[] = {
+        -0.5f, -0.5f, 0.0f,
+        0.0f,  0.5f, 0.0f,
+        0.5f, -0.5f, 0.0f,
+    };
+    
+    CreateMesh(TriangleVertexData, sizeof(TriangleVertexData),
+               3, 0, DEFAULT_MESH_TRIANGLE);
     
     // Rectangle
     
@@ -981,10 +2941,20 @@ void CreateDefaultMeshes() {
     
     CreateMesh(RectangleLinesVertexData, sizeof(RectangleLinesVertexData),
                3, 0, DEFAULT_MESH_RECTANGLE_LINES);
+    
+    // Batched text, two triangles per glyph, with uv
+    
+    CreateDynamicMesh(MAX_TEXT_GLYPHS * 6 * 5 * sizeof(float), 5, DEFAULT_MESH_TEXT);
+    
+    // HUD frame time graph, lines
+    
+    CreateDynamicMesh(HUD_HISTORY * 2 * 3 * sizeof(float), 3, DEFAULT_MESH_HUD_GRAPH);
 }
 
 
 
+#ifndef HEADLESS
+
 void DrawObject(v3 Position,
                 v3 Scale,
                 float Rotation,
@@ -996,16 +2966,46 @@ void DrawObject(v3 Position,
                 int InputLayout,
                 int PrimitiveTopology) {
     
-    if(Texture) {
+    if(SnapshotRecording) {
+        SnapshotAdd(Position, Scale, Rotation, Color, Mesh, Texture, Shader, ConstantBuffer, InputLayout,
+                    PrimitiveTopology, Textures[Texture].UOffset, Textures[Texture].VOffset);
+        return;
+    }
+    
+    // Only bind what changed since the last draw, atlas textures share
+    // one view & sampler
+    
+    if(Texture && Textures[Texture].ShaderResourceView != RenderState.ShaderResourceView) {
         ID3D11DeviceContext1_PSSetShaderResources(Context, 0, 1, &Textures[Texture].ShaderResourceView);
+        RenderState.ShaderResourceView = Textures[Texture].ShaderResourceView;
+        ++RenderStats.TextureBinds;
+    }
+    if(Texture && Textures[Texture].SamplerState != RenderState.SamplerState) {
         ID3D11DeviceContext1_PSSetSamplers(Context, 0, 1, &Textures[Texture].SamplerState);
+        RenderState.SamplerState = Textures[Texture].SamplerState;
+        ++RenderStats.StateChanges;
+    }
+    if(InputLayouts[InputLayout] != RenderState.InputLayout) {
+        ID3D11DeviceContext1_IASetInputLayout(Context, InputLayouts[InputLayout]);
+        RenderState.InputLayout = InputLayouts[InputLayout];
+        ++RenderStats.StateChanges;
+    }
+    if(Shader != RenderState.Shader) {
+        ID3D11DeviceContext1_VSSetShader(Context, Shaders[Shader].VertexShader, 0, 0);
+        ID3D11DeviceContext1_PSSetShader(Context, Shaders[Shader].PixelShader, 0, 0);
+        RenderState.Shader = Shader;
+        ++RenderStats.StateChanges;
+    }
+    if(PrimitiveTopology != RenderState.PrimitiveTopology) {
+        ID3D11DeviceContext1_IASetPrimitiveTopology(Context, PrimitiveTopology);
+        RenderState.PrimitiveTopology = PrimitiveTopology;
+        ++RenderStats.StateChanges;
+    }
+    if(Mesh != RenderState.Mesh) {
+        ID3D11DeviceContext1_IASetVertexBuffers(Context, 0, 1, &Meshes[Mesh].Buffer, &Meshes[Mesh].Stride, &Meshes[Mesh].Offset);
+        RenderState.Mesh = Mesh;
+        ++RenderStats.StateChanges;
     }
-    
-    ID3D11DeviceContext1_IASetInputLayout(Context, InputLayouts[InputLayout]);
-    ID3D11DeviceContext1_VSSetShader(Context, Shaders[Shader].VertexShader, 0, 0);
-    ID3D11DeviceContext1_PSSetShader(Context, Shaders[Shader].PixelShader, 0, 0);
-    ID3D11DeviceContext1_IASetPrimitiveTopology(Context, PrimitiveTopology);
-    ID3D11DeviceContext1_IASetVertexBuffers(Context, 0, 1, &Meshes[Mesh].Buffer, &Meshes[Mesh].Stride, &Meshes[Mesh].Offset);
     
     D3D11_MAPPED_SUBRESOURCE MappedSubresource;
     
@@ -1042,20 +3042,80 @@ void DrawObject(v3 Position,
     Constants->Color = Color;
     
     if(Texture) {
-        Constants->UOffset = Textures[Texture].UOffset;
-        Constants->VOffset = Textures[Texture].VOffset;
-        Constants->USize  = Textures[Texture].USize;
-        Constants->VSize  = Textures[Texture].VSize;
+        textureInfo Uvs = SnapshotUvs(Texture);
+        Constants->UOffset = Uvs.UOffset;
+        Constants->VOffset = Uvs.VOffset;
+        Constants->USize  = Uvs.USize;
+        Constants->VSize  = Uvs.VSize;
     }
     
     ID3D11DeviceContext1_Unmap(Context, (ID3D11Resource*)ConstantBuffers[ConstantBuffer], 0);
     ID3D11DeviceContext1_Draw(Context, Meshes[Mesh].NumVertices, 0);
+    ++RenderStats.DrawCalls;
+}
+
+#else
+
+void DrawObject(v3 Position,
+                v3 Scale,
+                float Rotation,
+                color Color,
+                int Mesh, 
+                int Texture,
+                int Shader,
+                int ConstantBuffer,
+                int InputLayout,
+                int PrimitiveTopology) {
+    
+    if(SnapshotRecording) {
+        SnapshotAdd(Position, Scale, Rotation, Color, Mesh, Texture, Shader, ConstantBuffer, InputLayout,
+                    PrimitiveTopology, Textures[Texture].UOffset, Textures[Texture].VOffset);
+        return;
+    }
+    
+    // Same counters as the D3D path, for comparable numbers
+    
+    if(Texture && Textures[Texture].Pixels != RenderState.TexturePixels) {
+        RenderState.TexturePixels = Textures[Texture].Pixels;
+        ++RenderStats.TextureBinds;
+    }
+    if(Shader != RenderState.Shader) {
+        RenderState.Shader = Shader;
+        ++RenderStats.StateChanges;
+    }
+    if(PrimitiveTopology != RenderState.PrimitiveTopology) {
+        RenderState.PrimitiveTopology = PrimitiveTopology;
+        ++RenderStats.StateChanges;
+    }
+    if(Mesh != RenderState.Mesh) {
+        RenderState.Mesh = Mesh;
+        ++RenderStats.StateChanges;
+    }
+    ++RenderStats.DrawCalls;
+    
+    SoftwareRendererDraw(Position, Scale, Rotation, Color, Mesh, Texture, Shader, PrimitiveTopology);
+}
+
+#endif
+
+// Call at the start of a frame. Forgets what is bound & keeps the
+// last frame's counters in FrameRenderStats.
+void ResetRenderState() {
+    RenderState = (renderState){
+        .Shader = -1,
+        .Mesh = -1,
+        .PrimitiveTopology = -1,
+    };
+    FrameRenderStats = RenderStats;
+    RenderStats = (renderStats){0};
 }
 
 void CreateDefaultBlendStates() {
     CreateBlendState();
 }
 
+#ifndef HEADLESS
+
 // TODO: params
 int CreateBlendState() {
     
@@ -1078,43 +3138,6 @@ int CreateBlendState() {
     return BlendStateCount-1;
 }
 
-// This is used to create temp shaders for input layouts
-int CreateShaderDiscard(const wchar_t* Filename, shaderInfo* Info, shader* Shader) {
-    
-    HRESULT Result = E_FAIL;
-    
-    if(Info == NULL) {
-        Result = D3DCompileFromFile(Filename, NULL, NULL, "vs_main", "vs_5_0", NULL, NULL, &Shader->VSBlob, NULL);
-        assert(SUCCEEDED(Result));
-        
-        Result = D3DCompileFromFile(Filename, NULL, NULL, "ps_main", "ps_5_0", NULL, NULL, &Shader->PSBlob, NULL);
-        assert(SUCCEEDED(Result));
-    } else {
-        // TODO: handle all Info fields
-        Result = D3DCompileFromFile(Filename, Info->VSMacros, NULL, "vs_main", "vs_5_0", NULL, NULL, &Shader->VSBlob, NULL);
-        assert(SUCCEEDED(Result));
-        Result = D3DCompileFromFile(Filename, Info->PSMacros, NULL, "ps_main", "ps_5_0", NULL, NULL, &Shader->PSBlob, NULL);
-        assert(SUCCEEDED(Result));
-        
-    }
-    
-    Result = ID3D11Device1_CreateVertexShader(Device,
-                                              ID3D10Blob_GetBufferPointer(Shader->VSBlob),
-                                              ID3D10Blob_GetBufferSize(Shader->VSBlob),
-                                              0,
-                                              &Shader->VertexShader);
-    assert(SUCCEEDED(Result));
-    
-    Result = ID3D11Device1_CreatePixelShader(Device,
-                                             ID3D10Blob_GetBufferPointer(Shader->PSBlob),
-                                             ID3D10Blob_GetBufferSize(Shader->PSBlob),
-                                             0,
-                                             &Shader->PixelShader);
-    assert(SUCCEEDED(Result));
-    
-    return Result;
-}
-
 int CreateShader(const wchar_t* Filename, shaderInfo* Info, int ShaderIndex) {
     
     int Index = ShaderIndex;
@@ -1123,31 +3146,58 @@ int CreateShader(const wchar_t* Filename, shaderInfo* Info, int ShaderIndex) {
     
     HRESULT Result = E_FAIL;
     
-    if(Info == NULL) {
-        Result = D3DCompileFromFile(Filename, NULL, NULL, "vs_main", "vs_5_0", NULL, NULL, &Shader->VSBlob, NULL);
-        assert(SUCCEEDED(Result));
-        
-        Result = D3DCompileFromFile(Filename, NULL, NULL, "ps_main", "ps_5_0", NULL, NULL, &Shader->PSBlob, NULL);
-        assert(SUCCEEDED(Result));
+    // Cooked bytecode only exists for shaders without macros
+    
+    char Name[64];
+    snprintf(Name, sizeof(Name), "%ls", Filename);
+    packEntry* VSEntry = (Info == NULL) ? PackFind(Name, PACK_ENTRY_VERTEX_SHADER) : NULL;
+    packEntry* PSEntry = (Info == NULL) ? PackFind(Name, PACK_ENTRY_PIXEL_SHADER) : NULL;
+    
+    const void* PSCode;
+    size_t PSCodeSize;
+    
+    if(VSEntry && PSEntry) {
+        Shader->VSCode = PackEntryData(VSEntry);
+        Shader->VSCodeSize = VSEntry->Size;
+        PSCode = PackEntryData(PSEntry);
+        PSCodeSize = PSEntry->Size;
     } else {
-        // TODO: handle all Info fields
-        Result = D3DCompileFromFile(Filename, Info->VSMacros, NULL, "vs_main", "vs_5_0", NULL, NULL, &Shader->VSBlob, NULL);
-        assert(SUCCEEDED(Result));
-        Result = D3DCompileFromFile(Filename, Info->PSMacros, NULL, "ps_main", "ps_5_0", NULL, NULL, &Shader->PSBlob, NULL);
-        assert(SUCCEEDED(Result));
+        if(Info == NULL) {
+            Result = D3DCompileFromFile(Filename, NULL, NULL, "vs_main", "vs_5_0", NULL, NULL, &Shader->VSBlob, NULL);
+            assert(SUCCEEDED(Result));
+            
+            Result = D3DCompileFromFile(Filename, NULL, NULL, "ps_main", "ps_5_0", NULL, NULL, &Shader->PSBlob, NULL);
+            assert(SUCCEEDED(Result));
+        } else {
+            // TODO: handle all Info fields
+            Result = D3DCompileFromFile(Filename, Info->VSMacros, NULL, "vs_main", "vs_5_0", NULL, NULL, &Shader->VSBlob, NULL);
+            assert(SUCCEEDED(Result));
+            Result = D3DCompileFromFile(Filename, Info->PSMacros, NULL, "ps_main", "ps_5_0", NULL, NULL, &Shader->PSBlob, NULL);
+            assert(SUCCEEDED(Result));
+            
+        }
         
+        Shader->VSCode = ID3D10Blob_GetBufferPointer(Shader->VSBlob);
+        Shader->VSCodeSize = ID3D10Blob_GetBufferSize(Shader->VSBlob);
+        PSCode = ID3D10Blob_GetBufferPointer(Shader->PSBlob);
+        PSCodeSize = ID3D10Blob_GetBufferSize(Shader->PSBlob);
+        
+        if(Pack.Cooking && Info == NULL) {
+            PackCook(Name, PACK_ENTRY_VERTEX_SHADER, Shader->VSCode, Shader->VSCodeSize, 0, 0, Name);
+            PackCook(Name, PACK_ENTRY_PIXEL_SHADER, PSCode, PSCodeSize, 0, 0, Name);
+        }
     }
     
     Result = ID3D11Device1_CreateVertexShader(Device,
-                                              ID3D10Blob_GetBufferPointer(Shader->VSBlob),
-                                              ID3D10Blob_GetBufferSize(Shader->VSBlob),
+                                              Shader->VSCode,
+                                              Shader->VSCodeSize,
                                               0,
                                               &Shader->VertexShader);
     assert(SUCCEEDED(Result));
     
     Result = ID3D11Device1_CreatePixelShader(Device,
-                                             ID3D10Blob_GetBufferPointer(Shader->PSBlob),
-                                             ID3D10Blob_GetBufferSize(Shader->PSBlob),
+                                             PSCode,
+                                             PSCodeSize,
                                              0,
                                              &Shader->PixelShader);
     assert(SUCCEEDED(Result));
@@ -1170,8 +3220,8 @@ int CreateInputLayout(shader* Shader,
         ID3D11Device1_CreateInputLayout(Device, 
                                         Desc,
                                         Size,
-                                        ID3D10Blob_GetBufferPointer(Shader->VSBlob),
-                                        ID3D10Blob_GetBufferSize(Shader->VSBlob),
+                                        Shader->VSCode,
+                                        Shader->VSCodeSize,
                                         &InputLayouts[Index]
                                         );
     assert(SUCCEEDED(Result));
@@ -1262,6 +3312,8 @@ void GridInit(grid* Grid) {
 
 void GridDraw(grid* Grid) {
     
+    ResetRenderState();
+    
     ID3D11DeviceContext1_IASetInputLayout(Context, Grid->InputLayout);
     ID3D11DeviceContext1_VSSetShader(Context, Grid->VertexShader, 0, 0);
     ID3D11DeviceContext1_PSSetShader(Context, Grid->PixelShader, 0, 0);
@@ -1288,8 +3340,51 @@ void GridDraw(grid* Grid) {
     
 }
 
+#else
+
+// The software renderer has one fixed ONE/INV_SRC_ALPHA blend
+// and emulates the default shaders by index
+
+int CreateBlendState() {
+    return BlendStateCount-1;
+}
+
+int CreateShader(const wchar_t* Filename, shaderInfo* Info, int ShaderIndex) {
+    int Index = ShaderIndex;
+    if(ShaderIndex == 0) Index = ShaderCount++;
+    return Index;
+}
+
+#endif
+
 // Camera
 
+void InitViewProjection() {
+    
+    // Projection matrix
+    
+    float AspectRatio = (float)ClientWidth / (float)ClientHeight;
+    float Height = 1.0f;
+    float Near = 1.0f;
+    float Far = 100.0f;
+    
+    ProjectionMatrix = (matrix){
+        2.0f * Near / AspectRatio, 0.0f, 0.0f, 0.0f,
+        0.0f, 2.0f * Near / Height, 0.0f, 0.0f,
+        0.0f, 0.0f, Far / (Far - Near), 1.0f,
+        0.0f, 0.0f, Near * Far / (Near - Far), 0.0f
+    };
+    
+    // View matrix
+    
+    ViewMatrix = (matrix){
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        -Camera.Position.X, -Camera.Position.Y, -Camera.Position.Z, 1.0f,
+    };
+}
+
 void CameraUpdateByAcceleration(v3 Acceleration) {
     v3 CameraVelocity = {0};
     
@@ -1306,203 +3401,4235 @@ void CameraUpdateByAcceleration(v3 Acceleration) {
 }
 
 
+// On the thread that renders. Under -split KeyDown & Mouse belong to the
+// simulation thread, so the camera keeps its own state from its copy of
+// the events. Like KeyDown a key tapped since the last call counts, & R
+// puts the camera back home.
 void HandleCamera() {
     
+    int Down[KEYSAMOUNT];
+    memcpy(Down, InputQueue.CameraDown, sizeof(Down));
+    int Wheel = 0;
+    
+    inputEvent Event;
+    while(MpscPop(&InputQueue.Camera, &Event, 1)) {
+        switch(Event.Type) {
+            case INPUT_KEY_DOWN: {
+                InputQueue.CameraDown[Event.Key] = 1;
+                Down[Event.Key] = 1;
+                if(Event.Key == R) Camera.Position = Camera.Home;
+            } break;
+            case INPUT_KEY_UP: {
+                InputQueue.CameraDown[Event.Key] = 0;
+            } break;
+            case INPUT_WHEEL: {
+                Wheel = Event.Key;
+            } break;
+        }
+    }
+    
     v3 CameraAcceleration = {0};
     
-    if(KeyDown[W]) {
+    if(Down[W]) {
         CameraAcceleration.Y = 1.0f; 
     }
-    if(KeyDown[A]) {
+    if(Down[A]) {
         CameraAcceleration.X = -1.0f; 
     }
-    if(KeyDown[S]) {
+    if(Down[S]) {
         CameraAcceleration.Y = -1.0f; 
     }
-    if(KeyDown[D]) {
+    if(Down[D]) {
         CameraAcceleration.X = 1.0f; 
     }
-    if(KeyDown[Q]) {
+    if(Down[Q]) {
         CameraAcceleration.Z = -1.0f;
     }
-    if(KeyDown[E]) {
+    if(Down[E]) {
         CameraAcceleration.Z = 1.0f; 
     }
     
-    if(Mouse.WheelDown) {
-        CameraAcceleration.Z = -10.0f;
-        Mouse.WheelDown = 0;
-    }
-    if(Mouse.WheelUp) {
-        CameraAcceleration.Z = 10.0f;
-        Mouse.WheelUp = 0;
+    if(Wheel) {
+        CameraAcceleration.Z = 10.0f * Wheel;
     }
     
     CameraUpdateByAcceleration(CameraAcceleration);
 }
 
-// Misc
+// Threads
 
-// Note: creates a mesh every iteration, for testing
-/*
-void DrawRectangle(rectangle* R, color Color) {
-    
-    float RectangleLinesVertexData[] = {
-        R->Left, R->Bottom, 0.0f,
-        R->Left, R->Top, 0.0f,
-        R->Left, R->Top, 0.0f,
-        R->Right, R->Top, 0.0f, 
-        R->Right, R->Top, 0.0f,
-        R->Right, R->Bottom, 0.0f,
-        R->Right, R->Bottom, 0.0f,
-        R->Left, R->Bottom, 0.0f,
+#ifdef _WIN32
+
+DWORD WINAPI ThreadEntry(LPVOID Data) {
+    thread* Thread = (thread*)Data;
+    Thread->Proc(Thread->Data);
+    return 0;
+}
+
+void ThreadStart(thread* Thread, threadProc* Proc, void* Data) {
+    Thread->Proc = Proc;
+    Thread->Data = Data;
+    Thread->Handle = CreateThread(NULL, 0, ThreadEntry, Thread, 0, NULL);
+    assert(Thread->Handle);
+}
+
+void ThreadJoin(thread* Thread) {
+    WaitForSingleObject(Thread->Handle, INFINITE);
+    CloseHandle(Thread->Handle);
+}
+
+void MutexInit(mutex* Mutex) {
+    InitializeCriticalSection(Mutex);
+}
+
+void MutexLock(mutex* Mutex) {
+    EnterCriticalSection(Mutex);
+}
+
+void MutexUnlock(mutex* Mutex) {
+    LeaveCriticalSection(Mutex);
+}
+
+void ConditionInit(condition* Condition) {
+    InitializeConditionVariable(Condition);
+}
+
+void ConditionWait(condition* Condition, mutex* Mutex) {
+    SleepConditionVariableCS(Condition, Mutex, INFINITE);
+}
+
+void ConditionBroadcast(condition* Condition) {
+    WakeAllConditionVariable(Condition);
+}
+
+// At the scheduler's granularity, 1 ms with timeBeginPeriod(1)
+void SleepMilliseconds(double Milliseconds) {
+    if(Milliseconds > 0.0) Sleep((DWORD)Milliseconds);
+}
+
+// Returns the new value
+long AtomicAdd(volatile long* Value, long Amount) {
+    return InterlockedExchangeAdd(Value, Amount) + Amount;
+}
+
+// Acquire, loads after it stay after it. Aligned 64 bit loads & stores
+// are atomic on x64 & only need the compiler kept in order.
+int64_t AtomicLoad64(volatile int64_t* Value) {
+    int64_t Result = *Value;
+    _ReadWriteBarrier();
+    return Result;
+}
+
+// Release, stores before it stay before it
+void AtomicStore64(volatile int64_t* Value, int64_t Amount) {
+    _ReadWriteBarrier();
+    *Value = Amount;
+}
+
+// Returns 1 when Value was Expected & is now Desired
+int AtomicCompareExchange64(volatile int64_t* Value, int64_t Expected, int64_t Desired) {
+    return InterlockedCompareExchange64((volatile LONG64*)Value, Desired, Expected) == Expected;
+}
+
+void ThreadYield() {
+    SwitchToThread();
+}
+
+int GetProcessorCount() {
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    return (int)Info.dwNumberOfProcessors;
+}
+
+#else
+
+void* ThreadEntry(void* Data) {
+    thread* Thread = (thread*)Data;
+    Thread->Proc(Thread->Data);
+    return NULL;
+}
+
+void ThreadStart(thread* Thread, threadProc* Proc, void* Data) {
+    Thread->Proc = Proc;
+    Thread->Data = Data;
+    int Result = pthread_create(&Thread->Handle, NULL, ThreadEntry, Thread);
+    assert(Result == 0);
+}
+
+void ThreadJoin(thread* Thread) {
+    pthread_join(Thread->Handle, NULL);
+}
+
+void MutexInit(mutex* Mutex) {
+    pthread_mutex_init(Mutex, NULL);
+}
+
+void MutexLock(mutex* Mutex) {
+    pthread_mutex_lock(Mutex);
+}
+
+void MutexUnlock(mutex* Mutex) {
+    pthread_mutex_unlock(Mutex);
+}
+
+void ConditionInit(condition* Condition) {
+    pthread_cond_init(Condition, NULL);
+}
+
+void ConditionWait(condition* Condition, mutex* Mutex) {
+    pthread_cond_wait(Condition, Mutex);
+}
+
+void ConditionBroadcast(condition* Condition) {
+    pthread_cond_broadcast(Condition);
+}
+
+void SleepMilliseconds(double Milliseconds) {
+    if(Milliseconds <= 0.0) return;
+    struct timespec Time = {
+        .tv_sec = (time_t)(Milliseconds / 1000.0),
+        .tv_nsec = (long)(fmod(Milliseconds, 1000.0) * 1000000.0),
     };
+    nanosleep(&Time, NULL);
+}
+
+// Returns the new value
+long AtomicAdd(volatile long* Value, long Amount) {
+    return __atomic_add_fetch(Value, Amount, __ATOMIC_SEQ_CST);
+}
+
+// Acquire, loads after it stay after it
+int64_t AtomicLoad64(volatile int64_t* Value) {
+    return __atomic_load_n(Value, __ATOMIC_ACQUIRE);
+}
+
+// Release, stores before it stay before it
+void AtomicStore64(volatile int64_t* Value, int64_t Amount) {
+    __atomic_store_n(Value, Amount, __ATOMIC_RELEASE);
+}
+
+// Returns 1 when Value was Expected & is now Desired
+int AtomicCompareExchange64(volatile int64_t* Value, int64_t Expected, int64_t Desired) {
+    return __atomic_compare_exchange_n(Value, &Expected, Desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+void ThreadYield() {
+    sched_yield();
+}
+
+int GetProcessorCount() {
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (Count > 0) ? (int)Count : 1;
+}
+
+#endif
+
+// Asset pack
+
+uint64_t HashBytes(const void* Data, size_t Size, uint64_t Hash) {
+    const unsigned char* Bytes = Data;
+    for(size_t Index = 0; Index < Size; ++Index) {
+        Hash ^= Bytes[Index];
+        Hash *= 0x100000001b3ull;
+    }
+    return Hash;
+}
+
+// FNV-1a, files that can't be read hash to the offset basis
+uint64_t HashFile(const char* File) {
+    uint64_t Hash = 0xcbf29ce484222325ull;
+    FILE* Handle = fopen(File, "rb");
+    if(!Handle) return Hash;
     
-    TestRectangleMesh = CreateMesh(RectangleLinesVertexData, sizeof(RectangleLinesVertexData),
-                                   3, 0, 0);
+    unsigned char Buffer[4096];
+    size_t Read;
+    while((Read = fread(Buffer, 1, sizeof(Buffer), Handle)) > 0) {
+        Hash = HashBytes(Buffer, Read, Hash);
+    }
     
-    DrawObject((v3){0.0f, 0.0f, 0.0f},
-               (v3){1.0f, 1.0f, 1.0f},
-               0.0f,
-               Color,
-               TestRectangleMesh,
-               0,
-               DEFAULT_SHADER_POSITION,
-               1,
-               DEFAULT_INPUT_LAYOUT_POSITION,
-               D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+    fclose(Handle);
+    return Hash;
 }
-*/
 
-int PickMeshRectangle(int MouseX, int MouseY, v3 Position, mesh* Mesh) {
+void PackClose() {
+    if(!Pack.Data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(Pack.Data);
+#else
+    munmap(Pack.Data, Pack.Size);
+#endif
+    Pack.Data = NULL;
+    Pack.Size = 0;
+    Pack.Entries = NULL;
+    Pack.EntryCount = 0;
+}
+
+// Maps the pack read only, entries point straight into the mapping.
+// Returns 0 and leaves the pack empty when the file is missing or
+// doesn't look like a pack of this version.
+int PackOpen(const char* File) {
     
-    int Result = 0;
-    float X = ((2.0f * (float)MouseX) / (float)ClientWidth) - 1.0f;
-    float Y = (((2.0f * (float)MouseY) / (float)ClientHeight) - 1.0f) * -1.0f;
+    PackClose();
     
-    X = X / ProjectionMatrix.M[0][0];
-    Y = Y / ProjectionMatrix.M[1][1];
+#ifdef _WIN32
+    HANDLE Handle = CreateFileA(File, GENERIC_READ, FILE_SHARE_READ, NULL, 
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(Handle == INVALID_HANDLE_VALUE) return 0;
     
-    matrix InverseViewMatrix = {0};
-    MatrixInverse(&ViewMatrix, &InverseViewMatrix);
+    LARGE_INTEGER FileSize = {0};
+    GetFileSizeEx(Handle, &FileSize);
     
-    v3 Direction = {0};
-    Direction.X = X * InverseViewMatrix.M[0][0] + Y * InverseViewMatrix.M[1][0] + InverseViewMatrix.M[2][0];
-    Direction.Y = X * InverseViewMatrix.M[0][1] + Y * InverseViewMatrix.M[1][1] + InverseViewMatrix.M[2][1];
-    Direction.Z = X * InverseViewMatrix.M[0][2] + Y * InverseViewMatrix.M[1][2] + InverseViewMatrix.M[2][2];
+    // The view keeps the mapping alive after the handles are closed
     
-    v3 Origin = Camera.Position;
+    HANDLE Mapping = CreateFileMappingA(Handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(Handle);
+    if(!Mapping) return 0;
+    
+    Pack.Data = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+    Pack.Size = (size_t)FileSize.QuadPart;
+    CloseHandle(Mapping);
+#else
+    int Handle = open(File, O_RDONLY);
+    if(Handle < 0) return 0;
+    
+    struct stat Stat;
+    if(fstat(Handle, &Stat) == 0 && Stat.st_size > 0) {
+        void* Data = mmap(NULL, Stat.st_size, PROT_READ, MAP_PRIVATE, Handle, 0);
+        if(Data != MAP_FAILED) {
+            Pack.Data = Data;
+            Pack.Size = Stat.st_size;
+        }
+    }
+    close(Handle);
+#endif
+    
+    if(!Pack.Data) return 0;
+    
+    packHeader* Header = (packHeader*)Pack.Data;
+    int Valid = Pack.Size >= sizeof(packHeader) &&
+        Header->Magic == PACK_MAGIC &&
+        Header->Version == PACK_VERSION &&
+        Header->Size == Pack.Size &&
+        Header->EntryCount <= MAX_PACK_ENTRIES;
+    
+    if(Valid) {
+        Pack.Entries = (packEntry*)(Pack.Data + sizeof(packHeader));
+        Pack.EntryCount = Header->EntryCount;
+        Valid = sizeof(packHeader) + Pack.EntryCount * sizeof(packEntry) <= Pack.Size;
+        for(int Index = 0; Index < Pack.EntryCount && Valid; ++Index) {
+            packEntry* Entry = &Pack.Entries[Index];
+            Valid = (size_t)Entry->Offset + Entry->Size <= Pack.Size &&
+                memchr(Entry->Name, 0, sizeof(Entry->Name)) != NULL;
+            
+            // Texture pixels are read as Width * Height RGBA8
+            
+            if(Valid && Entry->Type == PACK_ENTRY_TEXTURE) {
+                Valid = Entry->Width > 0 && Entry->Height > 0 &&
+                    (uint64_t)Entry->Width * Entry->Height * 4 <= Entry->Size;
+            }
+        }
+    }
+    
+    if(!Valid) {
+        Debug("%s: not a version %d pack, loading from sources\n", File, PACK_VERSION);
+        PackClose();
+        return 0;
+    }
+    
+    // Entries are named after their source file. Sources that are around
+    // & changed since cooking make the whole pack stale.
+    
+    for(int Index = 0; Index < Pack.EntryCount; ++Index) {
+        packEntry* Entry = &Pack.Entries[Index];
+        FILE* Source = fopen(Entry->Name, "rb");
+        if(!Source) continue;
+        fclose(Source);
+        if(HashFile(Entry->Name) != Entry->Hash) {
+            Debug("%s: %s changed since it was cooked, loading from sources (-cook again)\n",
+                  File, Entry->Name);
+            PackClose();
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+packEntry* PackFind(const char* Name, int Type) {
+    for(int Index = 0; Index < Pack.EntryCount; ++Index) {
+        packEntry* Entry = &Pack.Entries[Index];
+        if(Entry->Type == (u32)Type && !strcmp(Entry->Name, Name)) {
+            return Entry;
+        }
+    }
+    return NULL;
+}
+
+const void* PackEntryData(packEntry* Entry) {
+    return Pack.Data + Entry->Offset;
+}
+
+// For freeing loaded data that may live in the mapping
+int PackContains(const void* Pointer) {
+    const unsigned char* Byte = Pointer;
+    return Pack.Data && Byte >= Pack.Data && Byte < Pack.Data + Pack.Size;
+}
+
+// Keeps a copy of loaded data for PackWrite(). Source is the file the
+// data came from, its hash goes to the manifest.
+void PackCook(const char* Name, int Type, const void* Data, size_t Size, 
+              int Width, int Height, const char* Source) {
+    
+    assert(Pack.CookCount < MAX_PACK_ENTRIES);
+    assert(strlen(Name) < sizeof(Pack.CookEntries[0].Name));
+    
+    packEntry* Entry = &Pack.CookEntries[Pack.CookCount];
+    *Entry = (packEntry){
+        .Type = Type,
+        .Size = (u32)Size,
+        .Width = Width,
+        .Height = Height,
+        .Hash = HashFile(Source),
+    };
+    strcpy(Entry->Name, Name);
+    
+    Pack.CookData[Pack.CookCount] = malloc(Size);
+    assert(Pack.CookData[Pack.CookCount]);
+    memcpy(Pack.CookData[Pack.CookCount], Data, Size);
+    ++Pack.CookCount;
+}
+
+// Writes everything cooked so far & prints the manifest. Returns 0 on failure.
+int PackWrite(const char* File) {
+    
+    FILE* Handle = fopen(File, "wb");
+    if(!Handle) {
+        Debug("%s: can't write pack\n", File);
+        return 0;
+    }
+    
+    u32 Offset = sizeof(packHeader) + Pack.CookCount * sizeof(packEntry);
+    for(int Index = 0; Index < Pack.CookCount; ++Index) {
+        Offset = (Offset + 15) & ~15u;
+        Pack.CookEntries[Index].Offset = Offset;
+        Offset += Pack.CookEntries[Index].Size;
+    }
+    
+    packHeader Header = {
+        .Magic = PACK_MAGIC,
+        .Version = PACK_VERSION,
+        .EntryCount = Pack.CookCount,
+        .Size = Offset,
+    };
+    
+    int Ok = fwrite(&Header, sizeof(Header), 1, Handle) == 1;
+    Ok = Ok && fwrite(Pack.CookEntries, sizeof(packEntry), Pack.CookCount, Handle) == (size_t)Pack.CookCount;
+    
+    u32 Written = sizeof(packHeader) + Pack.CookCount * sizeof(packEntry);
+    char Padding[16] = {0};
+    
+    for(int Index = 0; Index < Pack.CookCount && Ok; ++Index) {
+        packEntry* Entry = &Pack.CookEntries[Index];
+        Ok = fwrite(Padding, 1, Entry->Offset - Written, Handle) == Entry->Offset - Written;
+        Ok = Ok && fwrite(Pack.CookData[Index], 1, Entry->Size, Handle) == Entry->Size;
+        Written = Entry->Offset + Entry->Size;
+    }
+    
+    Ok = (fclose(Handle) == 0) && Ok;
+    
+    if(!Ok) {
+        Debug("%s: write failed\n", File);
+        return 0;
+    }
+    
+    char* TypeNames[] = {"none", "texture", "vs", "ps"};
+    
+    Debug("%s: version %d, %d entries, %u bytes\n", File, PACK_VERSION, Pack.CookCount, Offset);
+    for(int Index = 0; Index < Pack.CookCount; ++Index) {
+        packEntry* Entry = &Pack.CookEntries[Index];
+        Debug("  %016llx %-7s %8u %s\n", (unsigned long long)Entry->Hash,
+              TypeNames[Entry->Type], Entry->Size, Entry->Name);
+    }
+    
+    return 1;
+}
+
+// Benchmarks
+
+int BenchCompare(const void* A, const void* B) {
+    double X = *(const double*)A;
+    double Y = *(const double*)B;
+    return (X > Y) - (X < Y);
+}
+
+// Runs Proc(Count) for each of Bench.Counts, Setup(Count) first when
+// given. Proc should do Count items of work, results are per item.
+void BenchRun(char* Name, benchProc* Setup, benchProc* Proc) {
+    
+    if(Bench.Filter && !strstr(Name, Bench.Filter)) return;
+    
+    for(int CountIndex = 0; CountIndex < Bench.CountCount; ++CountIndex) {
+        
+        int Count = Bench.Counts[CountIndex];
+        assert(Count > 0 && Count <= BENCH_MAX_COUNT);
+        assert(Bench.ResultCount < MAX_BENCH_RESULTS);
+        
+        // Kept with the result for BenchWrite
+        double* Times = malloc(Bench.Repetitions * sizeof(double));
+        assert(Times);
+        
+        if(Setup) Setup(Count);
+        
+        for(int Index = 0; Index < Bench.Warmup; ++Index) {
+            Proc(Count);
+        }
+        
+        double Sum = 0.0;
+        long CountersBefore[MAX_COUNTERS];
+        for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+            CountersBefore[Counter] = CounterRead(Counter);
+        }
+        
+        for(int Index = 0; Index < Bench.Repetitions; ++Index) {
+            int64_t Start = ClockNow();
+            int64_t End;
+            Proc(Count);
+            End = ClockNow();
+            Times[Index] = (double)(End - Start) / Count;
+            Sum += Times[Index];
+        }
+        
+        qsort(Times, Bench.Repetitions, sizeof(double), BenchCompare);
+        
+        benchResult* Result = &Bench.Results[Bench.ResultCount++];
+        *Result = (benchResult){
+            .Count = Count,
+            .Repetitions = Bench.Repetitions,
+            .Median = Times[Bench.Repetitions / 2],
+            .P99 = Times[(Bench.Repetitions * 99 + 99) / 100 - 1],
+            .Min = Times[0],
+            .Mean = Sum / Bench.Repetitions,
+            .Samples = Times,
+        };
+        snprintf(Result->Name, sizeof(Result->Name), "%s", Name);
+        
+        for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+            Result->Counters[Counter] = (double)(CounterRead(Counter) - CountersBefore[Counter]) /
+                ((double)Bench.Repetitions * Count);
+        }
+        
+        Debug("%-24s %6d  median %9.2f ns  p99 %9.2f ns  min %9.2f ns\n",
+              Name, Count, Result->Median, Result->P99, Result->Min);
+    }
+}
+
+// Writes the results as JSON. Returns 0 on failure.
+int BenchWrite(const char* File) {
+    
+    FILE* Handle = fopen(File, "w");
+    if(!Handle) {
+        Debug("%s: can't write results\n", File);
+        return 0;
+    }
+    
+    fprintf(Handle, "{\n  \"unit\": \"ns/item\",\n  \"warmup\": %d,\n  \"benchmarks\": [\n", Bench.Warmup);
+    
+    for(int Index = 0; Index < Bench.ResultCount; ++Index) {
+        benchResult* Result = &Bench.Results[Index];
+        fprintf(Handle, "    {\"name\": \"%s\", \"count\": %d, \"repetitions\": %d, "
+                "\"median\": %.3f, \"p99\": %.3f, \"min\": %.3f, \"mean\": %.3f, \"samples\": [",
+                Result->Name, Result->Count, Result->Repetitions,
+                Result->Median, Result->P99, Result->Min, Result->Mean);
+        for(int Sample = 0; Sample < Result->Repetitions; ++Sample) {
+            fprintf(Handle, "%s%.3f", Sample ? "," : "", Result->Samples[Sample]);
+        }
+        
+        // Counts per item, of the counters this one touched
+        
+        fprintf(Handle, "], \"counters\": {");
+        int First = 1;
+        for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+            if(Result->Counters[Counter] == 0.0) continue;
+            fprintf(Handle, "%s\"%s\": %.3f", First ? "" : ", ", Counters.Names[Counter], Result->Counters[Counter]);
+            First = 0;
+        }
+        fprintf(Handle, "}}%s\n", (Index + 1 < Bench.ResultCount) ? "," : "");
+    }
+    
+    fprintf(Handle, "  ]\n}\n");
+    
+    if(fclose(Handle) != 0) {
+        Debug("%s: write failed\n", File);
+        return 0;
+    }
+    
+    return 1;
+}
+
+// Inputs for the engine benchmarks, filled by BenchSetupEngine()
+
+matrix* BenchMatrices;
+v3* BenchVectors;
+rectangle* BenchRectangles;
+
+void BenchSetupEngine(int Count) {
+    
+    if(!BenchMatrices) {
+        BenchMatrices = MemoryAlloc((BENCH_MAX_COUNT + 1) * sizeof(matrix));
+        BenchVectors = MemoryAlloc(BENCH_MAX_COUNT * sizeof(v3));
+        BenchRectangles = MemoryAlloc((BENCH_MAX_COUNT + 1) * sizeof(rectangle));
+    }
+    
+    srand(1);
+    
+    for(int Index = 0; Index <= Count; ++Index) {
+        matrix Rotation = MatrixRotationZ((float)(rand() % 360));
+        matrix Translation = MatrixTranslation((v3){GetRandomZeroToOne(), GetRandomZeroToOne(), 0.0f});
+        BenchMatrices[Index] = MatrixMultiply(&Rotation, &Translation);
+        
+        float X = GetRandomZeroToOne() * 10.0f;
+        float Y = GetRandomZeroToOne() * 10.0f;
+        BenchRectangles[Index] = (rectangle){
+            .Left = X, .Right = X + 1.0f, .Top = Y + 1.0f, .Bottom = Y,
+        };
+    }
+    
+    for(int Index = 0; Index < Count; ++Index) {
+        BenchVectors[Index] = (v3){GetRandomZeroToOne(), GetRandomZeroToOne(), GetRandomZeroToOne()};
+    }
+}
+
+void BenchMatrixMultiply(int Count) {
+    for(int Index = 0; Index < Count; ++Index) {
+        matrix M = MatrixMultiply(&BenchMatrices[Index], &BenchMatrices[Index + 1]);
+        BENCH_KEEP(M);
+    }
+}
+
+void BenchMatrixV3Multiply(int Count) {
+    for(int Index = 0; Index < Count; ++Index) {
+        v3 V = MatrixV3Multiply(BenchMatrices[Index], BenchVectors[Index]);
+        BENCH_KEEP(V);
+    }
+}
+
+void BenchV3Normalize(int Count) {
+    for(int Index = 0; Index < Count; ++Index) {
+        v3 V = BenchVectors[Index];
+        V3Normalize(&V);
+        BENCH_KEEP(V);
+    }
+}
+
+void BenchRectanglesIntersect(int Count) {
+    int Hits = 0;
+    for(int Index = 0; Index < Count; ++Index) {
+        Hits += RectanglesIntersect(BenchRectangles[Index], BenchRectangles[Index + 1]);
+    }
+    BENCH_KEEP(Hits);
+}
+
+// Restores the arena so repetitions don't run out of memory
+void BenchMemoryAlloc(int Count) {
+    size_t Offset = Memory.Offset;
+    for(int Index = 0; Index < Count; ++Index) {
+        void* Pointer = MemoryAlloc(64);
+        BENCH_KEEP(Pointer);
+    }
+    Memory.Offset = Offset;
+}
+
+timerWheel BenchWheel;
+timerFired BenchFired[BENCH_MAX_COUNT];
+
+// Count timers due over the next 1000 ticks, like as many saucers
+void BenchSetupTimers(int Count) {
+    if(!BenchWheel.Nodes) TimerWheelInit(&BenchWheel, BENCH_MAX_COUNT + 1);
+    TimerWheelReset(&BenchWheel, 0);
+    srand(1);
+    for(int Index = 0; Index < Count; ++Index) {
+        TimerAdd(&BenchWheel, rand() % 1000 + 1, 0, Index);
+    }
+}
+
+// 100 ticks, every timer that fires is set again. No more than the Count
+// set up can fire at once.
+void BenchTimerAdvance(int Count) {
+    for(int Tick = 0; Tick < 100; ++Tick) {
+        int64_t Now = BenchWheel.Now + 1;
+        int Fired = TimerAdvance(&BenchWheel, Now, BenchFired, Count);
+        for(int Index = 0; Index < Fired; ++Index) {
+            TimerAdd(&BenchWheel, Now + 1000, 0, BenchFired[Index].Data);
+        }
+    }
+    BENCH_KEEP(BenchWheel.Count);
+}
+
+scheduler BenchScheduler;
+long BenchResumes;
+
+// Wakes every 1 to 1000 ticks, like a saucer between shots
+int BenchScript(coroutine* Coroutine) {
+    COROUTINE_BEGIN(Coroutine);
+    for(;;) {
+        ++BenchResumes;
+        COROUTINE_WAIT(Coroutine, Coroutine->Data % 1000 + 1);
+    }
+    COROUTINE_END(Coroutine);
+}
+
+// Count scripted enemies
+void BenchSetupScripts(int Count) {
+    if(!BenchScheduler.Coroutines) SchedulerInit(&BenchScheduler, BENCH_MAX_COUNT + 1);
+    SchedulerReset(&BenchScheduler, 0);
+    srand(1);
+    for(int Index = 0; Index < Count; ++Index) {
+        CoroutineStart(&BenchScheduler, BenchScript, rand(), rand() % 1000 + 1);
+    }
+}
+
+// 100 ticks, the Count scripts set up all keep running
+void BenchSchedulerRun(int Count) {
+    for(int Tick = 0; Tick < 100; ++Tick) {
+        SchedulerRun(&BenchScheduler, BenchScheduler.Wheel.Now + 1);
+    }
+    assert(BenchScheduler.Count == Count);
+    BENCH_KEEP(BenchResumes);
+}
+
+void BenchmarkEngine() {
+    BenchRun("MatrixMultiply", BenchSetupEngine, BenchMatrixMultiply);
+    BenchRun("MatrixV3Multiply", BenchSetupEngine, BenchMatrixV3Multiply);
+    BenchRun("V3Normalize", BenchSetupEngine, BenchV3Normalize);
+    BenchRun("RectanglesIntersect", BenchSetupEngine, BenchRectanglesIntersect);
+    BenchRun("MemoryAlloc", NULL, BenchMemoryAlloc);
+    BenchRun("TimerAdvance", BenchSetupTimers, BenchTimerAdvance);
+    BenchRun("SchedulerRun", BenchSetupScripts, BenchSchedulerRun);
+}
+
+#ifdef PROFILER
+
+// Profiler
+
+// Registers the calling thread as thread 0
+void ProfilerInit() {
+    Profiler.StartTime = ClockNow();
+    ProfileRegisterThread();
+}
+
+profileThread* ProfileRegisterThread() {
+    int Id = AtomicAdd(&Profiler.ThreadCount, 1) - 1;
+    assert(Id < PROFILER_MAX_THREADS);
+    profileThread* Thread = calloc(1, sizeof(profileThread));
+    assert(Thread);
+    Thread->Id = Id;
+    Profiler.Threads[Id] = Thread;
+    ProfileThread = Thread;
+    return Thread;
+}
+
+void ProfileEvent(const char* Name, int Begin) {
+    
+    int64_t Count = ClockNow();
+    
+    profileThread* Thread = ProfileThread;
+    if(!Thread) Thread = ProfileRegisterThread();
+    
+    profileEvent* Event = &Thread->Events[(unsigned long)Thread->Head & (PROFILER_EVENTS - 1)];
+    Event->Name = Name;
+    Event->Time = Count;
+    Event->Begin = Begin;
+    Event->IsValue = 0;
+    if(Perf.Thread == Thread) PerfRead(Event->Perf);
+    
+    // Publishes the event
+    
+    AtomicAdd(&Thread->Head, 1);
+}
+
+// A point on the counter track Name, shown as a graph under the zones
+void ProfileValue(const char* Name, double Value) {
+    
+    int64_t Count = ClockNow();
+    
+    profileThread* Thread = ProfileThread;
+    if(!Thread) Thread = ProfileRegisterThread();
+    
+    profileEvent* Event = &Thread->Events[(unsigned long)Thread->Head & (PROFILER_EVENTS - 1)];
+    Event->Name = Name;
+    Event->Time = Count;
+    Event->Begin = 0;
+    Event->IsValue = 1;
+    Event->Value = Value;
+    
+    AtomicAdd(&Thread->Head, 1);
+}
+
+// Chrome trace event JSON, opens in chrome://tracing or Perfetto.
+// Events written while this runs may be torn, call it when the other
+// threads are idle. Returns 0 on failure.
+int ProfilerWrite(const char* File) {
+    
+    FILE* Handle = fopen(File, "w");
+    if(!Handle) {
+        Debug("%s: can't write trace\n", File);
+        return 0;
+    }
+    
+    fprintf(Handle, "{\"traceEvents\":[\n");
+    ProfileWriteEvents(Handle, INT64_MIN, INT64_MAX, Profiler.StartTime, 0);
+    fprintf(Handle, "\n]}\n");
+    
+    if(fclose(Handle) != 0) {
+        Debug("%s: write failed\n", File);
+        return 0;
+    }
+    
+    return 1;
+}
+
+// Writes every thread's name & its events from time From to To, with
+// timestamps in microseconds since Base. Written is how many trace events
+// the caller wrote before, for the commas.
+void ProfileWriteEvents(FILE* Handle, int64_t From, int64_t To, int64_t Base, int Written) {
+    
+    long ThreadCount = AtomicAdd(&Profiler.ThreadCount, 0);
+    
+    for(int Id = 0; Id < ThreadCount; ++Id) {
+        profileThread* Thread = Profiler.Threads[Id];
+        if(!Thread) continue;
+        
+        fprintf(Handle, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s %d\"}}",
+                Written++ ? ",\n" : "", Id, Id ? "worker" : "main", Id);
+        
+        long Head = AtomicAdd(&Thread->Head, 0);
+        long First = (Head > PROFILER_EVENTS) ? Head - PROFILER_EVENTS : 0;
+        
+        for(long Index = First; Index < Head; ++Index) {
+            profileEvent* Event = &Thread->Events[(unsigned long)Index & (PROFILER_EVENTS - 1)];
+            if(Event->Time < From || Event->Time > To) continue;
+            double Microseconds = (double)(Event->Time - Base) / 1000.0;
+            if(Event->IsValue) {
+                fprintf(Handle, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                        "\"args\":{\"ms\":%.4f}}", Event->Name, Microseconds, Id, Event->Value);
+            } else if(Event->Begin) {
+                fprintf(Handle, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                        Event->Name, Microseconds, Id);
+            } else {
+                fprintf(Handle, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                        Microseconds, Id);
+            }
+        }
+    }
+}
+
+// Adds the inclusive time of every zone the calling thread closed between
+// events From and To to Zones, in milliseconds. Zones are told apart by name.
+void ProfileSumZones(long From, long To, scenarioZone* Zones, int* ZoneCount, int MaxZones) {
+    
+    profileThread* Thread = ProfileThread;
+    if(!Thread) return;
+    if(To - From > PROFILER_EVENTS) From = To - PROFILER_EVENTS;
+    
+    profileEvent* Stack[64];
+    int Depth = 0;
+    
+    for(long Index = From; Index < To; ++Index) {
+        profileEvent* Event = &Thread->Events[(unsigned long)Index & (PROFILER_EVENTS - 1)];
+        if(Event->IsValue) continue;
+        
+        if(Event->Begin) {
+            if(Depth < (int)ARRAYSIZE(Stack)) Stack[Depth] = Event;
+            ++Depth;
+            continue;
+        }
+        
+        if(Depth == 0) continue;
+        if(--Depth >= (int)ARRAYSIZE(Stack)) continue;
+        
+        profileEvent* Begin = Stack[Depth];
+        double Milliseconds = NanosecondsToMilliseconds(Event->Time - Begin->Time);
+        
+        // The read for the begin event runs inside the zone, the read for
+        // the end event outside, so each zone includes one read
+        
+        int Zone = 0;
+        while(Zone < *ZoneCount && Zones[Zone].Name != Begin->Name && 
+              strcmp(Zones[Zone].Name, Begin->Name)) {
+            ++Zone;
+        }
+        if(Zone == *ZoneCount) {
+            if(*ZoneCount == MaxZones) continue;
+            Zones[(*ZoneCount)++] = (scenarioZone){ .Name = Begin->Name };
+        }
+        Zones[Zone].Milliseconds += Milliseconds;
+        for(int Counter = 0; Counter < PERF_COUNTERS; ++Counter) {
+            Zones[Zone].Perf[Counter] += Event->Perf[Counter] - Begin->Perf[Counter];
+        }
+    }
+}
+
+#endif
+
+// Hardware counters
+
+// Opens cycles, instructions, cache & branch misses for the calling
+// thread, user space only, and has ProfileEvent() read them. Counters
+// the CPU or kernel won't give stay 0. Returns 0 when none could be
+// opened, e.g. in VMs without a PMU or with perf_event_paranoid > 2.
+int PerfOpen() {
+    
+#if defined(__linux__) && defined(PROFILER)
+    uint64_t Configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    
+    for(int Counter = 0; Counter < PERF_COUNTERS; ++Counter) {
+        
+        struct perf_event_attr Attributes = {
+            .type = PERF_TYPE_HARDWARE,
+            .size = sizeof(struct perf_event_attr),
+            .config = Configs[Counter],
+            .disabled = (Perf.Group == -1),
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+            .read_format = PERF_FORMAT_GROUP,
+        };
+        
+        int Fd = syscall(SYS_perf_event_open, &Attributes, 0, -1, Perf.Group, 0);
+        if(Fd == -1) {
+            Debug("perf: no %s (%s)\n", PerfNames[Counter], strerror(errno));
+            continue;
+        }
+        
+        if(Perf.Group == -1) Perf.Group = Fd;
+        Perf.Opened[Counter] = 1;
+        Perf.Order[Perf.OrderCount++] = Counter;
+    }
+    
+    if(Perf.Group == -1) return 0;
+    
+    ioctl(Perf.Group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(Perf.Group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    
+    Perf.Thread = ProfileThread ? ProfileThread : ProfileRegisterThread();
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Counters that aren't open read 0
+void PerfRead(uint64_t* Values) {
+    
+#ifdef __linux__
+    uint64_t Buffer[1 + PERF_COUNTERS];
+    if(read(Perf.Group, Buffer, sizeof(Buffer)) <= 0) return;
+    
+    for(uint64_t Index = 0; Index < Buffer[0] && Index < (uint64_t)Perf.OrderCount; ++Index) {
+        Values[Perf.Order[Index]] = Buffer[1 + Index];
+    }
+#endif
+}
+
+// Counters
+
+// Returns the counter's index for CounterAdd()
+int CounterRegister(const char* Name) {
+    assert(Counters.Count < MAX_COUNTERS);
+    Counters.Names[Counters.Count] = Name;
+    return Counters.Count++;
+}
+
+counterThread* CounterRegisterThread() {
+    int Id = AtomicAdd(&Counters.ThreadCount, 1) - 1;
+    assert(Id < COUNTER_MAX_THREADS);
+    CounterThread = &Counters.Threads[Id];
+    return CounterThread;
+}
+
+void CounterAdd(int Counter, long Value) {
+    counterThread* Thread = CounterThread;
+    if(!Thread) Thread = CounterRegisterThread();
+    Thread->Values[Counter] += Value;
+}
+
+// Everything counted so far, including the current tick
+long CounterRead(int Counter) {
+    long Value = Counters.Stats.Total[Counter];
+    for(int Thread = 0; Thread < Counters.ThreadCount; ++Thread) {
+        Value += Counters.Threads[Thread].Values[Counter];
+    }
+    return Value;
+}
+
+// Call after every tick, while no other thread is counting. Moves the
+// threads' counts into the tick, the stats and the running second.
+void CountersTick() {
+    
+    ++Counters.Stats.Ticks;
+    
+    for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+        
+        long Value = 0;
+        for(int Thread = 0; Thread < Counters.ThreadCount; ++Thread) {
+            Value += Counters.Threads[Thread].Values[Counter];
+            Counters.Threads[Thread].Values[Counter] = 0;
+        }
+        
+        int Bucket = 0;
+        while(Bucket < COUNTER_BUCKETS - 1 && (Value >> Bucket)) ++Bucket;
+        
+        Counters.Tick[Counter] = Value;
+        Counters.Second[Counter] += Value;
+        Counters.Stats.Total[Counter] += Value;
+        if(Value > Counters.Stats.Max[Counter]) Counters.Stats.Max[Counter] = Value;
+        ++Counters.Stats.Histogram[Counter][Bucket];
+    }
+    
+    double Elapsed = Timer.ElapsedMilliSeconds - Counters.SecondStart;
+    if(Elapsed < 1000.0) return;
+    
+    char Line[1024];
+    int Length = snprintf(Line, sizeof(Line), "counters %.0fs:", Timer.ElapsedMilliSeconds / 1000.0);
+    
+    for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+        Counters.Rate[Counter] = Counters.Second[Counter] * 1000.0 / Elapsed;
+        Counters.Second[Counter] = 0;
+        if(Length < (int)sizeof(Line)) {
+            Length += snprintf(Line + Length, sizeof(Line) - Length, " %s %.0f/s",
+                               Counters.Names[Counter], Counters.Rate[Counter]);
+        }
+    }
+    Counters.SecondStart = Timer.ElapsedMilliSeconds;
+    
+    if(Counters.Log) Debug("%s\n", Line);
+}
+
+// Starts new stats, e.g. for each scenario. Counts of the current tick
+// are dropped.
+void CountersReset() {
+    for(int Thread = 0; Thread < Counters.ThreadCount; ++Thread) {
+        memset(Counters.Threads[Thread].Values, 0, sizeof(Counters.Threads[Thread].Values));
+    }
+    Counters.Stats = (counterStats){0};
+}
+
+void CountersPrint(counterStats* Stats) {
+    for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+        Debug("  %-15s %10ld total %9.1f/tick max %6ld  ticks by count:", Counters.Names[Counter],
+              Stats->Total[Counter], (double)Stats->Total[Counter] / (Stats->Ticks ? Stats->Ticks : 1),
+              Stats->Max[Counter]);
+        for(int Bucket = 0; Bucket < COUNTER_BUCKETS; ++Bucket) {
+            if(Stats->Histogram[Counter][Bucket]) {
+                Debug(" %ld+:%d", Bucket ? 1L << (Bucket - 1) : 0L, Stats->Histogram[Counter][Bucket]);
+            }
+        }
+        Debug("\n");
+    }
+}
+
+// Jobs
+
+// Work stealing: each worker has a deque of its own and steals from the
+// others when it's empty. A deque has a lock, taken by its owner on every
+// push & pop as well as by thieves, so it's a short lock rather than a
+// lock free deque. Workers sleep when nothing is queued.
+void JobsInit(int WorkerCount) {
+    
+    if(WorkerCount < 1) WorkerCount = 1;
+    if(WorkerCount > MAX_JOB_WORKERS) WorkerCount = MAX_JOB_WORKERS;
+    
+    if(!Jobs.Initialized) {
+        MutexInit(&Jobs.Mutex);
+        ConditionInit(&Jobs.WorkReady);
+        for(int Index = 0; Index < MAX_JOB_WORKERS; ++Index) {
+            MutexInit(&Jobs.Deques[Index].Mutex);
+        }
+        Jobs.Initialized = 1;
+    }
+    
+    Jobs.WorkerCount = WorkerCount;
+    Jobs.Stop = 0;
+    
+    for(int Index = 1; Index < WorkerCount; ++Index) {
+        ThreadStart(&Jobs.Threads[Index], JobWorkerProc, (void*)(intptr_t)Index);
+    }
+}
+
+// Stops the workers, e.g. to start again with another count. Nothing may
+// be queued.
+void JobsShutdown() {
+    
+    MutexLock(&Jobs.Mutex);
+    Jobs.Stop = 1;
+    ConditionBroadcast(&Jobs.WorkReady);
+    MutexUnlock(&Jobs.Mutex);
+    
+    for(int Index = 1; Index < Jobs.WorkerCount; ++Index) {
+        ThreadJoin(&Jobs.Threads[Index]);
+    }
+    Jobs.WorkerCount = 1;
+}
+
+// Onto this thread's deque. Counter goes up now and down once the job is done.
+void JobPush(job* Job) {
+    
+    AtomicAdd(Job->Counter, 1);
+    
+    jobDeque* Deque = &Jobs.Deques[JobWorker];
+    MutexLock(&Deque->Mutex);
+    assert(Deque->Bottom - Deque->Top < JOB_DEQUE_SIZE);
+    Deque->Jobs[Deque->Bottom & (JOB_DEQUE_SIZE - 1)] = *Job;
+    AtomicStore64(&Deque->Bottom, Deque->Bottom + 1);
+    MutexUnlock(&Deque->Mutex);
+    
+    // Counted once it can be taken, so nobody wakes to an empty deque.
+    // Sleepers count themselves before checking Queued, so either they
+    // see the job or we see them
+    
+    AtomicAdd(&Jobs.Queued, 1);
+    
+    if(AtomicAdd(&Jobs.Sleeping, 0)) {
+        MutexLock(&Jobs.Mutex);
+        ConditionBroadcast(&Jobs.WorkReady);
+        MutexUnlock(&Jobs.Mutex);
+    }
+}
+
+// Newest job of our own deque first, then the oldest of someone else's.
+// Returns 0 when there's nothing anywhere.
+int JobTake(job* Job) {
+    
+    for(int Offset = 0; Offset < Jobs.WorkerCount; ++Offset) {
+        
+        jobDeque* Deque = &Jobs.Deques[(JobWorker + Offset) % Jobs.WorkerCount];
+        if(AtomicLoad64(&Deque->Bottom) == AtomicLoad64(&Deque->Top)) continue;
+        
+        int Found = 0;
+        MutexLock(&Deque->Mutex);
+        if(Deque->Bottom > Deque->Top) {
+            if(Offset == 0) {
+                AtomicStore64(&Deque->Bottom, Deque->Bottom - 1);
+                *Job = Deque->Jobs[Deque->Bottom & (JOB_DEQUE_SIZE - 1)];
+            } else {
+                *Job = Deque->Jobs[Deque->Top & (JOB_DEQUE_SIZE - 1)];
+                AtomicStore64(&Deque->Top, Deque->Top + 1);
+            }
+            Found = 1;
+        }
+        MutexUnlock(&Deque->Mutex);
+        
+        if(Found) {
+            AtomicAdd(&Jobs.Queued, -1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void JobExecute(job* Job) {
+    
+    while(Job->End - Job->Begin > Job->Grain) {
+        job Half = *Job;
+        Half.Begin = Job->Begin + (Job->End - Job->Begin) / 2;
+        JobPush(&Half);
+        Job->End = Half.Begin;
+    }
+    
+    Job->Proc(Job->Begin, Job->End, Job->Data);
+    AtomicAdd(Job->Counter, -1);
+}
+
+// Runs queued jobs until Counter is down to 0, so waiting never idles
+// while there's work. With nothing left to steal the rest is running on
+// other workers, so it yields to them rather than spinning.
+void JobWait(volatile long* Counter) {
+    while(AtomicAdd(Counter, 0) > 0) {
+        job Job;
+        if(JobTake(&Job)) {
+            JobExecute(&Job);
+        } else {
+            ThreadYield();
+        }
+    }
+}
+
+void JobWorkerProc(void* Data) {
+    
+    JobWorker = (int)(intptr_t)Data;
+    
+    for(;;) {
+        
+        job Job;
+        if(JobTake(&Job)) {
+            JobExecute(&Job);
+            continue;
+        }
+        
+        MutexLock(&Jobs.Mutex);
+        AtomicAdd(&Jobs.Sleeping, 1);
+        while(AtomicAdd(&Jobs.Queued, 0) <= 0 && !Jobs.Stop) {
+            ConditionWait(&Jobs.WorkReady, &Jobs.Mutex);
+        }
+        AtomicAdd(&Jobs.Sleeping, -1);
+        int Stop = Jobs.Stop;
+        MutexUnlock(&Jobs.Mutex);
+        
+        if(Stop) break;
+    }
+}
+
+// Calls Proc over 0 to Count - 1 in ranges of at most Grain items, spread
+// over the workers, and returns when they're all done. Which thread runs
+// which range varies, so Proc should only touch its own items. With one
+// worker, or Count within Grain, it's a single call on this thread.
+void ParallelFor(int Count, int Grain, jobProc* Proc, void* Data) {
+    
+    if(Count <= 0) return;
+    if(Grain < 1) Grain = 1;
+    
+    if(Jobs.WorkerCount <= 1 || Count <= Grain) {
+        Proc(0, Count, Data);
+        return;
+    }
+    
+    volatile long Counter = 1;
+    job Job = {
+        .Proc = Proc,
+        .Data = Data,
+        .Begin = 0,
+        .End = Count,
+        .Grain = Grain,
+        .Counter = &Counter,
+    };
+    JobExecute(&Job);
+    JobWait(&Counter);
+}
+
+// Queues
+
+void SpscInit(spscQueue* Queue, int ItemSize, int Capacity) {
+    assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0);
+    *Queue = (spscQueue){
+        .Items = MemoryAlloc((size_t)ItemSize * Capacity),
+        .ItemSize = ItemSize,
+        .Capacity = Capacity,
+    };
+    assert(Queue->Items);
+}
+
+// Copies Count items between Items & the ring from Position on, in at
+// most two runs where it wraps
+void QueueCopy(unsigned char* Ring, int ItemSize, int Capacity, int64_t Position, unsigned char* Items,
+               int Count, int ToRing) {
+    int Start = (int)(Position & (Capacity - 1));
+    int First = (Count < Capacity - Start) ? Count : Capacity - Start;
+    unsigned char* Slot = Ring + (size_t)Start * ItemSize;
+    unsigned char* Rest = Items + (size_t)First * ItemSize;
+    if(ToRing) {
+        memcpy(Slot, Items, (size_t)First * ItemSize);
+        memcpy(Ring, Rest, (size_t)(Count - First) * ItemSize);
+    } else {
+        memcpy(Items, Slot, (size_t)First * ItemSize);
+        memcpy(Rest, Ring, (size_t)(Count - First) * ItemSize);
+    }
+}
+
+// Producer only. Returns how many of the Count items fit, 0 when full.
+int SpscPush(spscQueue* Queue, const void* Items, int Count) {
+    
+    int64_t Tail = Queue->Tail;
+    if(Tail + Count - Queue->CachedHead > Queue->Capacity) {
+        Queue->CachedHead = AtomicLoad64(&Queue->Head);
+    }
+    
+    int64_t Free = Queue->Capacity - (Tail - Queue->CachedHead);
+    if(Count > Free) Count = (int)Free;
+    if(Count <= 0) return 0;
+    
+    QueueCopy(Queue->Items, Queue->ItemSize, Queue->Capacity, Tail, (unsigned char*)Items, Count, 1);
+    AtomicStore64(&Queue->Tail, Tail + Count);
+    return Count;
+}
+
+// Consumer only. Returns how many items it took, up to Count.
+int SpscPop(spscQueue* Queue, void* Items, int Count) {
+    
+    int64_t Head = Queue->Head;
+    if(Queue->CachedTail - Head < Count) {
+        Queue->CachedTail = AtomicLoad64(&Queue->Tail);
+    }
+    
+    int64_t Used = Queue->CachedTail - Head;
+    if(Count > Used) Count = (int)Used;
+    if(Count <= 0) return 0;
+    
+    QueueCopy(Queue->Items, Queue->ItemSize, Queue->Capacity, Head, Items, Count, 0);
+    AtomicStore64(&Queue->Head, Head + Count);
+    return Count;
+}
+
+void MpscInit(mpscQueue* Queue, int ItemSize, int Capacity) {
+    assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0);
+    *Queue = (mpscQueue){
+        .Sequences = MemoryAlloc(Capacity * sizeof(int64_t)),
+        .Items = MemoryAlloc((size_t)ItemSize * Capacity),
+        .ItemSize = ItemSize,
+        .Capacity = Capacity,
+    };
+    assert(Queue->Sequences && Queue->Items);
+    
+    // No position is published until its sequence is position + 1
+    
+    for(int Index = 0; Index < Capacity; ++Index) {
+        Queue->Sequences[Index] = Index - Capacity;
+    }
+}
+
+// Any thread. Claims up to Count slots in one go, returns how many, 0
+// when full. The consumer frees slots in order, so Head says which are.
+int MpscPush(mpscQueue* Queue, const void* Items, int Count) {
+    
+    int64_t Tail;
+    for(;;) {
+        Tail = AtomicLoad64(&Queue->Tail);
+        int64_t Free = Queue->Capacity - (Tail - AtomicLoad64(&Queue->Head));
+        if(Count > Free) Count = (int)Free;
+        if(Count <= 0) return 0;
+        if(AtomicCompareExchange64(&Queue->Tail, Tail, Tail + Count)) break;
+    }
+    
+    const unsigned char* Item = Items;
+    for(int Index = 0; Index < Count; ++Index) {
+        int64_t Position = Tail + Index;
+        int Slot = (int)(Position & (Queue->Capacity - 1));
+        memcpy(Queue->Items + (size_t)Slot * Queue->ItemSize, Item, Queue->ItemSize);
+        AtomicStore64(&Queue->Sequences[Slot], Position + 1);
+        Item += Queue->ItemSize;
+    }
+    return Count;
+}
+
+// Consumer only. Stops at the first slot that's claimed but not yet
+// written, returns how many items it took.
+int MpscPop(mpscQueue* Queue, void* Items, int Count) {
+    
+    int64_t Head = Queue->Head;
+    unsigned char* Item = Items;
+    
+    int Popped = 0;
+    for(; Popped < Count; ++Popped) {
+        int64_t Position = Head + Popped;
+        int Slot = (int)(Position & (Queue->Capacity - 1));
+        if(AtomicLoad64(&Queue->Sequences[Slot]) != Position + 1) break;
+        memcpy(Item, Queue->Items + (size_t)Slot * Queue->ItemSize, Queue->ItemSize);
+        Item += Queue->ItemSize;
+    }
+    
+    if(Popped) AtomicStore64(&Queue->Head, Head + Popped);
+    return Popped;
+}
+
+// Queue benchmark
+
+// Items are the producer in the top 16 bits & its count below
+typedef struct {
+    spscQueue* Spsc;
+    mpscQueue* Mpsc;
+    int Producer;
+    int64_t Count;
+    int Batch;
+} queueBenchThread;
+
+void QueueBenchProducer(void* Data) {
+    
+    queueBenchThread* Thread = Data;
+    uint64_t Items[QUEUE_BENCH_BATCH];
+    
+    for(int64_t Sent = 0; Sent < Thread->Count;) {
+        
+        int Count = Thread->Batch;
+        if(Count > Thread->Count - Sent) Count = (int)(Thread->Count - Sent);
+        for(int Index = 0; Index < Count; ++Index) {
+            Items[Index] = ((uint64_t)Thread->Producer << 48) | (uint64_t)(Sent + Index);
+        }
+        
+        int Pushed = Thread->Spsc ? SpscPush(Thread->Spsc, Items, Count) :
+            MpscPush(Thread->Mpsc, Items, Count);
+        if(!Pushed) ThreadYield();
+        Sent += Pushed;
+    }
+}
+
+// Moves QUEUE_BENCH_ITEMS through each queue one at a time & in batches,
+// with the consumer on this thread checking every producer's items
+// arrive once & in order. Build with -fsanitize=thread to race check.
+// Returns 0 when any didn't.
+int BenchmarkQueues() {
+    
+    spscQueue Spsc;
+    mpscQueue Mpsc;
+    SpscInit(&Spsc, sizeof(uint64_t), QUEUE_BENCH_CAPACITY);
+    MpscInit(&Mpsc, sizeof(uint64_t), QUEUE_BENCH_CAPACITY);
+    
+    int Failed = 0;
+    
+    for(int Run = 0; Run < 2 + 2 * 3; ++Run) {
+        
+        // SPSC then MPSC with 1, 2 & QUEUE_BENCH_PRODUCERS producers, each
+        // one item at a time & batched
+        
+        int Multi = Run >= 2;
+        int Batch = (Run % 2) ? QUEUE_BENCH_BATCH : 1;
+        int Producers = Multi ? ((Run - 2) / 2 == 2 ? QUEUE_BENCH_PRODUCERS : (Run - 2) / 2 + 1) : 1;
+        
+        thread Threads[QUEUE_BENCH_PRODUCERS];
+        queueBenchThread Data[QUEUE_BENCH_PRODUCERS];
+        int64_t Expected[QUEUE_BENCH_PRODUCERS] = {0};
+        
+        int64_t Start = ClockNow();
+        
+        for(int Producer = 0; Producer < Producers; ++Producer) {
+            Data[Producer] = (queueBenchThread){
+                .Spsc = Multi ? NULL : &Spsc,
+                .Mpsc = Multi ? &Mpsc : NULL,
+                .Producer = Producer,
+                .Count = QUEUE_BENCH_ITEMS / Producers,
+                .Batch = Batch,
+            };
+            ThreadStart(&Threads[Producer], QueueBenchProducer, &Data[Producer]);
+        }
+        
+        int64_t Total = (int64_t)(QUEUE_BENCH_ITEMS / Producers) * Producers;
+        uint64_t Items[QUEUE_BENCH_BATCH];
+        
+        for(int64_t Received = 0; Received < Total;) {
+            int Popped = Multi ? MpscPop(&Mpsc, Items, Batch) : SpscPop(&Spsc, Items, Batch);
+            if(!Popped) ThreadYield();
+            for(int Index = 0; Index < Popped; ++Index) {
+                int Producer = (int)(Items[Index] >> 48);
+                int64_t Sequence = (int64_t)(Items[Index] & 0xffffffffffffull);
+                if(Producer >= Producers || Sequence != Expected[Producer]++) ++Failed;
+            }
+            Received += Popped;
+        }
+        
+        for(int Producer = 0; Producer < Producers; ++Producer) {
+            ThreadJoin(&Threads[Producer]);
+        }
+        
+        int64_t End = ClockNow();
+        double Milliseconds = NanosecondsToMilliseconds(End - Start);
+        
+        Debug("%s %d producer%s, batch %2d: %7.2f M items/s\n", Multi ? "mpsc" : "spsc",
+              Producers, (Producers == 1) ? " " : "s", Batch, Total / Milliseconds / 1000.0);
+    }
+    
+    if(Failed) {
+        Debug("queue-bench: %d items out of order or lost\n", Failed);
+    }
+    return !Failed;
+}
+
+// Input events
+
+void InputInit() {
+    MpscInit(&InputQueue.Events, sizeof(inputEvent), INPUT_QUEUE_SIZE);
+    MpscInit(&InputQueue.Camera, sizeof(inputEvent), INPUT_QUEUE_SIZE);
+}
+
+// Drops queued events & lets go of every key
+void InputReset() {
+    inputEvent Event;
+    while(MpscPop(&InputQueue.Events, &Event, 1));
+    while(MpscPop(&InputQueue.Camera, &Event, 1));
+    InputQueue.HasNext = 0;
+    memset(InputQueue.Down, 0, sizeof(InputQueue.Down));
+    memset(InputQueue.CameraDown, 0, sizeof(InputQueue.CameraDown));
+    memset(KeyDown, 0, sizeof(KeyDown));
+    memset(KeyPressed, 0, sizeof(KeyPressed));
+}
+
+// From any thread, stamped now unless Event.Time is set. Returns 0 when
+// the queue is full & the event was dropped.
+int InputPush(inputEvent Event) {
+    
+    if(!Event.Time) {
+        int64_t Now = ClockNow();
+        Event.Time = Now;
+    }
+    
+    // Losing a camera event only costs a camera move
+    
+    MpscPush(&InputQueue.Camera, &Event, 1);
+    
+    if(!MpscPush(&InputQueue.Events, &Event, 1)) {
+        AtomicAdd(&InputQueue.Dropped, 1);
+        return 0;
+    }
+    return 1;
+}
+
+// Call before each tick's Input(). Applies the events up to Until in the
+// order they happened, so a key tapped within a tick still counts as
+// down & pressed in it, & two taps are two presses.
+void InputTick(int64_t Until) {
+    
+    int64_t Now = ClockNow();
+    
+    memcpy(KeyDown, InputQueue.Down, sizeof(KeyDown));
+    memset(KeyPressed, 0, sizeof(KeyPressed));
+    Mouse.WheelUp = 0;
+    Mouse.WheelDown = 0;
+    
+    for(;;) {
+        
+        inputEvent Event = InputQueue.Next;
+        if(!InputQueue.HasNext && !MpscPop(&InputQueue.Events, &Event, 1)) break;
+        
+        if(Event.Time > Until) {
+            InputQueue.Next = Event;
+            InputQueue.HasNext = 1;
+            break;
+        }
+        InputQueue.HasNext = 0;
+        
+        switch(Event.Type) {
+            case INPUT_KEY_DOWN: {
+                InputQueue.Down[Event.Key] = 1;
+                KeyDown[Event.Key] = 1;
+                ++KeyPressed[Event.Key];
+            } break;
+            case INPUT_KEY_UP: {
+                InputQueue.Down[Event.Key] = 0;
+                KeyDown[Event.Key] = (KeyPressed[Event.Key] > 0);
+            } break;
+            case INPUT_MOUSE_DOWN: {
+                if(Event.Key == 0) {
+                    Mouse.LeftButtonPressed = 1;
+                } else {
+                    Mouse.RightButtonPressed = 1;
+                }
+                Mouse.X = Event.X;
+                Mouse.Y = Event.Y;
+            } break;
+            case INPUT_WHEEL: {
+                if(Event.Key > 0) {
+                    Mouse.WheelUp = 1;
+                } else {
+                    Mouse.WheelDown = 1;
+                }
+            } break;
+        }
+        
+        double Latency = NanosecondsToMilliseconds(Now - Event.Time);
+        HistogramAdd(&FrameStats.InputLatency, Latency);
+        PROFILE_VALUE("Input latency", Latency);
+    }
+}
+
+// Timer wheel
+
+// Room for Capacity - 1 timers at once
+void TimerWheelInit(timerWheel* Wheel, int Capacity) {
+    Wheel->Nodes = MemoryAlloc(Capacity * sizeof(timerNode));
+    assert(Wheel->Nodes);
+    Wheel->Capacity = Capacity;
+    TimerWheelReset(Wheel, 0);
+}
+
+// Drops every timer, Now is the tick that just ran
+void TimerWheelReset(timerWheel* Wheel, int64_t Now) {
+    memset(Wheel->Slots, 0, sizeof(Wheel->Slots));
+    for(int Index = 1; Index < Wheel->Capacity; ++Index) {
+        Wheel->Nodes[Index].Next = (Index + 1 < Wheel->Capacity) ? Index + 1 : 0;
+        Wheel->Nodes[Index].Level = -1;
+    }
+    Wheel->Free = (Wheel->Capacity > 1) ? 1 : 0;
+    Wheel->Count = 0;
+    Wheel->Now = Now;
+}
+
+// Puts the node in the slot its due tick falls in, seen from Now
+void TimerLink(timerWheel* Wheel, int Handle) {
+    
+    timerNode* Node = &Wheel->Nodes[Handle];
+    int64_t Delta = Node->Due - Wheel->Now;
+    
+    int Level = 0;
+    while(Level < TIMER_WHEEL_LEVELS - 1 && Delta >= (int64_t)1 << (TIMER_WHEEL_BITS * (Level + 1))) {
+        ++Level;
+    }
+    assert(Delta < (int64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS));
+    
+    int Slot = (int)(Node->Due >> (TIMER_WHEEL_BITS * Level)) & (TIMER_WHEEL_SLOTS - 1);
+    
+    Node->Level = Level;
+    Node->Slot = Slot;
+    Node->Previous = 0;
+    Node->Next = Wheel->Slots[Level][Slot];
+    if(Node->Next) Wheel->Nodes[Node->Next].Previous = Handle;
+    Wheel->Slots[Level][Slot] = Handle;
+}
+
+// Returns a handle for TimerCancel(), 0 when the wheel is full. Due ticks
+// that already passed fire on the next one.
+int TimerAdd(timerWheel* Wheel, int64_t Due, int Kind, int Data) {
+    
+    int Handle = Wheel->Free;
+    if(!Handle) return 0;
+    Wheel->Free = Wheel->Nodes[Handle].Next;
+    ++Wheel->Count;
+    
+    timerNode* Node = &Wheel->Nodes[Handle];
+    Node->Due = (Due > Wheel->Now) ? Due : Wheel->Now + 1;
+    Node->Kind = Kind;
+    Node->Data = Data;
+    TimerLink(Wheel, Handle);
+    return Handle;
+}
+
+// Fine with 0 or a timer that fired already
+void TimerCancel(timerWheel* Wheel, int Handle) {
+    
+    if(!Handle) return;
+    timerNode* Node = &Wheel->Nodes[Handle];
+    if(Node->Level < 0) return;
+    
+    if(Node->Previous) {
+        Wheel->Nodes[Node->Previous].Next = Node->Next;
+    } else {
+        Wheel->Slots[Node->Level][Node->Slot] = Node->Next;
+    }
+    if(Node->Next) Wheel->Nodes[Node->Next].Previous = Node->Previous;
+    
+    Node->Level = -1;
+    Node->Next = Wheel->Free;
+    Wheel->Free = Handle;
+    --Wheel->Count;
+}
+
+// Steps the wheel to Tick & hands back the timers due on the way, at most
+// MaxFired. The rest of a tick's timers fire on the next call, before
+// any later ones. Returns how many fired.
+int TimerAdvance(timerWheel* Wheel, int64_t Tick, timerFired* Fired, int MaxFired) {
+    
+    int FiredCount = 0;
+    
+    for(;;) {
+        
+        int Slot = (int)Wheel->Now & (TIMER_WHEEL_SLOTS - 1);
+        while(Wheel->Slots[0][Slot] && FiredCount < MaxFired) {
+            int Handle = Wheel->Slots[0][Slot];
+            timerNode* Node = &Wheel->Nodes[Handle];
+            assert(Node->Due == Wheel->Now);
+            Fired[FiredCount++] = (timerFired){
+                .Kind = Node->Kind,
+                .Data = Node->Data,
+                .Handle = Handle,
+            };
+            TimerCancel(Wheel, Handle);
+        }
+        if(Wheel->Slots[0][Slot] || Wheel->Now >= Tick) break;
+        
+        ++Wheel->Now;
+        
+        // Slots of upper levels that start now move down, the top first
+        // so their timers can go all the way
+        
+        for(int Level = TIMER_WHEEL_LEVELS - 1; Level > 0; --Level) {
+            if(Wheel->Now & (((int64_t)1 << (TIMER_WHEEL_BITS * Level)) - 1)) continue;
+            int Upper = (int)(Wheel->Now >> (TIMER_WHEEL_BITS * Level)) & (TIMER_WHEEL_SLOTS - 1);
+            int Handle = Wheel->Slots[Level][Upper];
+            Wheel->Slots[Level][Upper] = 0;
+            while(Handle) {
+                int After = Wheel->Nodes[Handle].Next;
+                TimerLink(Wheel, Handle);
+                Handle = After;
+            }
+        }
+    }
+    
+    return FiredCount;
+}
+
+// Coroutines
+
+// Room for Capacity - 1 coroutines at once
+void SchedulerInit(scheduler* Scheduler, int Capacity) {
+    Scheduler->Coroutines = MemoryAlloc(Capacity * sizeof(coroutine));
+    assert(Scheduler->Coroutines);
+    Scheduler->Capacity = Capacity;
+    TimerWheelInit(&Scheduler->Wheel, Capacity);
+    SchedulerReset(Scheduler, 0);
+}
+
+// Drops every coroutine, Now is the tick that just ran
+void SchedulerReset(scheduler* Scheduler, int64_t Now) {
+    for(int Index = 1; Index < Scheduler->Capacity; ++Index) {
+        Scheduler->Coroutines[Index] = (coroutine){
+            .Next = (Index + 1 < Scheduler->Capacity) ? Index + 1 : 0,
+        };
+    }
+    Scheduler->Free = (Scheduler->Capacity > 1) ? 1 : 0;
+    Scheduler->Count = 0;
+    TimerWheelReset(&Scheduler->Wheel, Now);
+}
+
+// Returns an id, 0 when full. Proc first runs on the Due tick.
+int CoroutineStart(scheduler* Scheduler, coroutineProc* Proc, int Data, int64_t Due) {
+    
+    int Id = Scheduler->Free;
+    if(!Id) return 0;
+    Scheduler->Free = Scheduler->Coroutines[Id].Next;
+    ++Scheduler->Count;
+    
+    Scheduler->Coroutines[Id] = (coroutine){
+        .Proc = Proc,
+        .Data = Data,
+    };
+    CoroutineWaitUntil(Scheduler, Id, Due);
+    return Id;
+}
+
+// From the start of Proc again on the Due tick, whatever it was waiting
+// for. Not from inside its own Proc, which decides its next wait.
+void CoroutineRestart(scheduler* Scheduler, int Id, int64_t Due) {
+    Scheduler->Coroutines[Id].Line = 0;
+    CoroutineWaitUntil(Scheduler, Id, Due);
+}
+
+void CoroutineStop(scheduler* Scheduler, int Id) {
+    coroutine* Coroutine = &Scheduler->Coroutines[Id];
+    if(!Coroutine->Proc) return;
+    TimerCancel(&Scheduler->Wheel, Coroutine->Timer);
+    *Coroutine = (coroutine){ .Next = Scheduler->Free };
+    Scheduler->Free = Id;
+    --Scheduler->Count;
+}
+
+// Replaces the current wait, the next tick at the earliest
+void CoroutineWaitUntil(scheduler* Scheduler, int Id, int64_t Due) {
+    coroutine* Coroutine = &Scheduler->Coroutines[Id];
+    TimerCancel(&Scheduler->Wheel, Coroutine->Timer);
+    Coroutine->Timer = TimerAdd(&Scheduler->Wheel, Due, 0, Id);
+    assert(Coroutine->Timer);
+}
+
+// Steps to Tick & hands back the ids of the coroutines due on the way, at
+// most MaxDue, without running them. For callers that resume them in an
+// order of their own.
+int SchedulerAdvance(scheduler* Scheduler, int64_t Tick, int* Due, int MaxDue) {
+    
+    int DueCount = 0;
+    
+    while(DueCount < MaxDue) {
+        
+        timerFired Fired[64];
+        int MaxFired = MaxDue - DueCount;
+        if(MaxFired > (int)ARRAYSIZE(Fired)) MaxFired = (int)ARRAYSIZE(Fired);
+        
+        int FiredCount = TimerAdvance(&Scheduler->Wheel, Tick, Fired, MaxFired);
+        for(int Index = 0; Index < FiredCount; ++Index) {
+            Scheduler->Coroutines[Fired[Index].Data].Timer = 0;
+            Due[DueCount++] = Fired[Index].Data;
+        }
+        if(FiredCount < MaxFired) break;
+    }
+    
+    return DueCount;
+}
+
+// Runs a due coroutine until its next wait. Ones stopped or given another
+// wait since they fell due are skipped.
+void CoroutineResume(scheduler* Scheduler, int Id) {
+    
+    coroutine* Coroutine = &Scheduler->Coroutines[Id];
+    if(!Coroutine->Proc || Coroutine->Timer) return;
+    
+    int Ticks = Coroutine->Proc(Coroutine);
+    if(Ticks == COROUTINE_DONE) {
+        CoroutineStop(Scheduler, Id);
+    } else {
+        CoroutineWaitUntil(Scheduler, Id, Scheduler->Wheel.Now + Ticks);
+    }
+}
+
+// Steps to Tick & resumes what's due in the order it fell due, returns
+// how many ran
+int SchedulerRun(scheduler* Scheduler, int64_t Tick) {
+    
+    int Resumed = 0;
+    
+    for(;;) {
+        int Due[64];
+        int DueCount = SchedulerAdvance(Scheduler, Tick, Due, (int)ARRAYSIZE(Due));
+        for(int Index = 0; Index < DueCount; ++Index) {
+            CoroutineResume(Scheduler, Due[Index]);
+        }
+        Resumed += DueCount;
+        if(DueCount < (int)ARRAYSIZE(Due)) return Resumed;
+    }
+}
+
+// Asset loader
+
+// The calling thread decodes too while it waits, like the software
+// renderer, so one thread means no workers
+void LoaderInit(int ThreadCount) {
+    
+    if(ThreadCount < 1) ThreadCount = 1;
+    if(ThreadCount > MAX_LOADER_THREADS) ThreadCount = MAX_LOADER_THREADS;
+    Loader.ThreadCount = ThreadCount;
+    
+    MutexInit(&Loader.Mutex);
+    ConditionInit(&Loader.WorkReady);
+    ConditionInit(&Loader.WorkDone);
+    
+    for(int Index = 1; Index < ThreadCount; ++Index) {
+        ThreadStart(&Loader.Threads[Index], LoaderWorker, NULL);
+    }
+}
+
+// Returns the job for LoaderTake()
+int LoaderQueue(const char* File) {
+    
+    MutexLock(&Loader.Mutex);
+    
+    int Job = Loader.JobCount;
+    loadJob* LoadJob = &Loader.Jobs[Job % MAX_LOAD_JOBS];
+    assert(LoadJob->State == LOAD_FREE); // More than MAX_LOAD_JOBS not taken yet
+    *LoadJob = (loadJob){
+        .State = LOAD_QUEUED,
+    };
+    assert(strlen(File) < sizeof(LoadJob->File));
+    strcpy(LoadJob->File, File);
+    ++Loader.JobCount;
+    
+    ConditionBroadcast(&Loader.WorkReady);
+    MutexUnlock(&Loader.Mutex);
+    
+    return Job;
+}
+
+// Decodes one queued image. Returns 0 when nothing was queued.
+int LoaderDecodeNext() {
+    
+    MutexLock(&Loader.Mutex);
+    if(Loader.NextJob == Loader.JobCount) {
+        MutexUnlock(&Loader.Mutex);
+        return 0;
+    }
+    loadJob* Job = &Loader.Jobs[Loader.NextJob++ % MAX_LOAD_JOBS];
+    Job->State = LOAD_DECODING;
+    char File[sizeof(Job->File)];
+    strcpy(File, Job->File);
+    MutexUnlock(&Loader.Mutex);
+    
+    PROFILE_BEGIN("Decode");
+    int Width;
+    int Height;
+    int Channels;
+    unsigned char* Pixels = stbi_load(File, &Width, &Height, &Channels, 4);
+    assert(Pixels);
+    PROFILE_END();
+    
+    MutexLock(&Loader.Mutex);
+    Job->Pixels = Pixels;
+    Job->Width = Width;
+    Job->Height = Height;
+    Job->State = LOAD_DECODED;
+    ++Loader.DecodedCount;
+    ConditionBroadcast(&Loader.WorkDone);
+    MutexUnlock(&Loader.Mutex);
+    
+    return 1;
+}
+
+void LoaderWorker(void* Data) {
+    for(;;) {
+        MutexLock(&Loader.Mutex);
+        while(Loader.NextJob == Loader.JobCount) {
+            ConditionWait(&Loader.WorkReady, &Loader.Mutex);
+        }
+        MutexUnlock(&Loader.Mutex);
+        
+        LoaderDecodeNext();
+    }
+}
+
+// Blocks until everything queued has been decoded
+void LoaderWait() {
+    
+    while(LoaderDecodeNext());
+    
+    MutexLock(&Loader.Mutex);
+    while(Loader.DecodedCount < Loader.JobCount) {
+        ConditionWait(&Loader.WorkDone, &Loader.Mutex);
+    }
+    MutexUnlock(&Loader.Mutex);
+}
+
+// Hands a decoded image over to the caller, who frees it, & frees the slot
+unsigned char* LoaderTake(int Job, int* Width, int* Height) {
+    
+    MutexLock(&Loader.Mutex);
+    
+    loadJob* LoadJob = &Loader.Jobs[Job % MAX_LOAD_JOBS];
+    assert(LoadJob->State == LOAD_DECODED);
+    unsigned char* Pixels = LoadJob->Pixels;
+    *Width = LoadJob->Width;
+    *Height = LoadJob->Height;
+    *LoadJob = (loadJob){
+        .State = LOAD_FREE,
+    };
+    
+    MutexUnlock(&Loader.Mutex);
+    
+    return Pixels;
+}
+
+#ifdef HEADLESS
+
+// Software renderer
+
+// Emulates what the GPU does with the default shaders: triangle & line
+// lists, the ONE/INV_SRC_ALPHA blend from CreateBlendState() into an
+// RGBA8 target and linear filtered sRGB textures. Primitives are set up
+// and binned into tiles as they are drawn, tiles are rasterized in
+// parallel by SoftwareRendererFlush().
+
+u32 SoftwarePackColor(float R, float G, float B, float A) {
+    R = (R < 0.0f) ? 0.0f : (R > 1.0f) ? 1.0f : R;
+    G = (G < 0.0f) ? 0.0f : (G > 1.0f) ? 1.0f : G;
+    B = (B < 0.0f) ? 0.0f : (B > 1.0f) ? 1.0f : B;
+    A = (A < 0.0f) ? 0.0f : (A > 1.0f) ? 1.0f : A;
+    // Bytes in memory: R, G, B, A
+    return ((u32)(R * 255.0f + 0.5f)) |
+        ((u32)(G * 255.0f + 0.5f) << 8) |
+        ((u32)(B * 255.0f + 0.5f) << 16) |
+        ((u32)(A * 255.0f + 0.5f) << 24);
+}
+
+// Premultiplied blend: Source + Dest * (1 - Source.A)
+u32 SoftwareBlend(u32 Dest, float R, float G, float B, float A) {
+    float* Unorm = SoftwareRenderer.UnormToFloat;
+    float InvA = 1.0f - A;
+    return SoftwarePackColor(R + Unorm[Dest & 0xff] * InvA,
+                             G + Unorm[(Dest >> 8) & 0xff] * InvA,
+                             B + Unorm[(Dest >> 16) & 0xff] * InvA,
+                             A + Unorm[Dest >> 24] * InvA);
+}
+
+// Bilinear, clamped, like the sampler from CreateTexture()
+void SoftwareSample(texture* Texture, float U, float V, float* Out) {
+    
+    float* Srgb = SoftwareRenderer.SrgbToLinear;
+    float* Unorm = SoftwareRenderer.UnormToFloat;
+    
+    float X = U * Texture->Width - 0.5f;
+    float Y = V * Texture->Height - 0.5f;
+    float FloorX = floorf(X);
+    float FloorY = floorf(Y);
+    float TX = X - FloorX;
+    float TY = Y - FloorY;
+    
+    int X0 = (int)FloorX;
+    int Y0 = (int)FloorY;
+    int X1 = X0 + 1;
+    int Y1 = Y0 + 1;
+    
+    int MaxX = Texture->Width - 1;
+    int MaxY = Texture->Height - 1;
+    X0 = (X0 < 0) ? 0 : (X0 > MaxX) ? MaxX : X0;
+    X1 = (X1 < 0) ? 0 : (X1 > MaxX) ? MaxX : X1;
+    Y0 = (Y0 < 0) ? 0 : (Y0 > MaxY) ? MaxY : Y0;
+    Y1 = (Y1 < 0) ? 0 : (Y1 > MaxY) ? MaxY : Y1;
+    
+    unsigned char* P00 = &Texture->Pixels[(Y0 * Texture->Width + X0) * 4];
+    unsigned char* P10 = &Texture->Pixels[(Y0 * Texture->Width + X1) * 4];
+    unsigned char* P01 = &Texture->Pixels[(Y1 * Texture->Width + X0) * 4];
+    unsigned char* P11 = &Texture->Pixels[(Y1 * Texture->Width + X1) * 4];
+    
+    for(int Channel = 0; Channel < 4; ++Channel) {
+        float* Table = (Channel < 3) ? Srgb : Unorm;
+        float Top = Table[P00[Channel]] + (Table[P10[Channel]] - Table[P00[Channel]]) * TX;
+        float Bottom = Table[P01[Channel]] + (Table[P11[Channel]] - Table[P01[Channel]]) * TX;
+        Out[Channel] = Top + (Bottom - Top) * TY;
+    }
+}
+
+// Coverage of pixels X..X+3 on row Y, bit per pixel. Edge values are
+// returned for attribute interpolation.
+int SoftwareCoverage4(softwarePrimitive* Primitive, int X, int Y, float Edges[3][4]) {
+    
+    int Mask = 0xf;
+    
+#ifdef SOFTWARE_SIMD
+    __m128 XS = _mm_add_ps(_mm_set1_ps((float)X), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+    __m128 Zero = _mm_setzero_ps();
+    
+    for(int Edge = 0; Edge < 3; ++Edge) {
+        __m128 E = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Primitive->EdgeA[Edge]), XS),
+                              _mm_set1_ps(Primitive->EdgeB[Edge] * (float)Y + Primitive->EdgeC[Edge]));
+        __m128 Inside = Primitive->EdgeTopLeft[Edge] ? _mm_cmpge_ps(E, Zero) : _mm_cmpgt_ps(E, Zero);
+        Mask &= _mm_movemask_ps(Inside);
+        _mm_storeu_ps(Edges[Edge], E);
+    }
+#else
+    for(int Edge = 0; Edge < 3; ++Edge) {
+        float RowValue = Primitive->EdgeB[Edge] * (float)Y + Primitive->EdgeC[Edge];
+        for(int Lane = 0; Lane < 4; ++Lane) {
+            float E = Primitive->EdgeA[Edge] * (float)(X + Lane) + RowValue;
+            int Inside = Primitive->EdgeTopLeft[Edge] ? (E >= 0.0f) : (E > 0.0f);
+            if(!Inside) Mask &= ~(1 << Lane);
+            Edges[Edge][Lane] = E;
+        }
+    }
+#endif
+    
+    return Mask;
+}
+
+void SoftwareShadePixel(softwarePrimitive* Primitive, u32* Pixel, float E0, float E1, float E2) {
+    
+    if(Primitive->Opaque) {
+        *Pixel = Primitive->PackedColor;
+        return;
+    }
+    
+    color Color = Primitive->Color;
+    
+    if(Primitive->Texture) {
+        float InvW = E0 * Primitive->InvW[0] + E1 * Primitive->InvW[1] + E2 * Primitive->InvW[2];
+        float U = (E0 * Primitive->UW[0] + E1 * Primitive->UW[1] + E2 * Primitive->UW[2]) / InvW;
+        float V = (E0 * Primitive->VW[0] + E1 * Primitive->VW[1] + E2 * Primitive->VW[2]) / InvW;
+        float Sample[4];
+        SoftwareSample(&Textures[Primitive->Texture], U, V, Sample);
+        Color.R *= Sample[0];
+        Color.G *= Sample[1];
+        Color.B *= Sample[2];
+        Color.A *= Sample[3];
+    }
+    
+    *Pixel = SoftwareBlend(*Pixel, Color.R, Color.G, Color.B, Color.A);
+}
+
+// -1 when the rectangle is outside the triangle, 1 when fully inside, 0 otherwise.
+// Edge functions are linear so the corners bound every pixel in between.
+int SoftwareClassifyRectangle(softwarePrimitive* Primitive, int MinX, int MinY, int MaxX, int MaxY) {
+    
+    int Result = 1;
+    
+    for(int Edge = 0; Edge < 3; ++Edge) {
+        float A = Primitive->EdgeA[Edge];
+        float B = Primitive->EdgeB[Edge];
+        float C = Primitive->EdgeC[Edge];
+        float E0 = A * MinX + B * MinY + C;
+        float E1 = A * MaxX + B * MinY + C;
+        float E2 = A * MinX + B * MaxY + C;
+        float E3 = A * MaxX + B * MaxY + C;
+        float Min = fminf(fminf(E0, E1), fminf(E2, E3));
+        float Max = fmaxf(fmaxf(E0, E1), fmaxf(E2, E3));
+        if(Max < 0.0f) return -1;
+        if(Min <= 0.0f) Result = 0;
+    }
+    
+    return Result;
+}
+
+void SoftwareRasterizeTriangle(softwarePrimitive* Primitive, int MinX, int MinY, int MaxX, int MaxY) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    
+    int Class = SoftwareClassifyRectangle(Primitive, MinX, MinY, MaxX, MaxY);
+    if(Class < 0) return;
+    
+    // Walk 8x8 blocks, edge tests only where an edge crosses the block
+    
+    float Edges[3][4];
+    
+    for(int BlockY = MinY; BlockY <= MaxY; BlockY = (BlockY + 8) & ~7) {
+        int BlockMaxY = ((BlockY + 8) & ~7) - 1;
+        if(BlockMaxY > MaxY) BlockMaxY = MaxY;
+        
+        for(int BlockX = MinX; BlockX <= MaxX; BlockX = (BlockX + 8) & ~7) {
+            int BlockMaxX = ((BlockX + 8) & ~7) - 1;
+            if(BlockMaxX > MaxX) BlockMaxX = MaxX;
+            
+            int BlockClass = Class ? Class : SoftwareClassifyRectangle(Primitive, BlockX, BlockY, BlockMaxX, BlockMaxY);
+            if(BlockClass < 0) continue;
+            
+            if(BlockClass > 0 && Primitive->Opaque) {
+                for(int Y = BlockY; Y <= BlockMaxY; ++Y) {
+                    u32* Row = &Renderer->Pixels[Y * Renderer->Width];
+                    for(int X = BlockX; X <= BlockMaxX; ++X) {
+                        Row[X] = Primitive->PackedColor;
+                    }
+                }
+                continue;
+            }
+            
+            for(int Y = BlockY; Y <= BlockMaxY; ++Y) {
+                u32* Row = &Renderer->Pixels[Y * Renderer->Width];
+                for(int X = BlockX & ~3; X <= BlockMaxX; X += 4) {
+                    int Mask = SoftwareCoverage4(Primitive, X, Y, Edges);
+                    if(BlockClass > 0) Mask = 0xf;
+                    for(int Lane = 0; Lane < 4; ++Lane) {
+                        int PixelX = X + Lane;
+                        if(!(Mask & (1 << Lane)) || PixelX < BlockX || PixelX > BlockMaxX) continue;
+                        SoftwareShadePixel(Primitive, &Row[PixelX], 
+                                           Edges[0][Lane], Edges[1][Lane], Edges[2][Lane]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Walks the whole line, writes only the pixels inside the rectangle.
+// The last pixel is left out like the GPU's diamond exit rule does.
+void SoftwareRasterizeLine(softwarePrimitive* Primitive, int MinX, int MinY, int MaxX, int MaxY) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    
+    float DX = Primitive->X1 - Primitive->X0;
+    float DY = Primitive->Y1 - Primitive->Y0;
+    int Steps = (int)ceilf(fmaxf(fabsf(DX), fabsf(DY)));
+    if(Steps <= 0) return;
+    
+    color Color = Primitive->Color;
+    
+    for(int Step = 0; Step < Steps; ++Step) {
+        float T = (float)Step / (float)Steps;
+        int X = (int)floorf(Primitive->X0 + DX * T);
+        int Y = (int)floorf(Primitive->Y0 + DY * T);
+        if(X < MinX || X > MaxX || Y < MinY || Y > MaxY) continue;
+        u32* Pixel = &Renderer->Pixels[Y * Renderer->Width + X];
+        *Pixel = SoftwareBlend(*Pixel, Color.R, Color.G, Color.B, Color.A);
+    }
+}
+
+void SoftwareRasterizeTile(int Tile) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    
+    int TileMinX = (Tile % Renderer->TilesX) * SOFTWARE_TILE_SIZE;
+    int TileMinY = (Tile / Renderer->TilesX) * SOFTWARE_TILE_SIZE;
+    int TileMaxX = TileMinX + SOFTWARE_TILE_SIZE - 1;
+    int TileMaxY = TileMinY + SOFTWARE_TILE_SIZE - 1;
+    if(TileMaxX >= Renderer->Width) TileMaxX = Renderer->Width - 1;
+    if(TileMaxY >= Renderer->Height) TileMaxY = Renderer->Height - 1;
+    
+    int* Bin = &Renderer->TileBins[Tile * SOFTWARE_MAX_TILE_PRIMITIVES];
+    int BinCount = Renderer->TileBinCounts[Tile];
+    
+    // Everything under an opaque triangle covering the whole tile is
+    // overwritten anyway, the clear included
+    
+    int First = 0;
+    int Covered = 0;
+    for(int Index = BinCount - 1; Index >= 0 && !Covered; --Index) {
+        softwarePrimitive* Primitive = &Renderer->Primitives[Bin[Index]];
+        if(Primitive->Opaque && Primitive->Type == SOFTWARE_PRIMITIVE_TRIANGLE &&
+           SoftwareClassifyRectangle(Primitive, TileMinX, TileMinY, TileMaxX, TileMaxY) > 0) {
+            First = Index;
+            Covered = 1;
+        }
+    }
+    
+    if(Renderer->ClearPending && !Covered) {
+        for(int Y = TileMinY; Y <= TileMaxY; ++Y) {
+            u32* Row = &Renderer->Pixels[Y * Renderer->Width];
+            for(int X = TileMinX; X <= TileMaxX; ++X) {
+                Row[X] = Renderer->ClearColor;
+            }
+        }
+    }
+    
+    for(int Index = First; Index < BinCount; ++Index) {
+        softwarePrimitive* Primitive = &Renderer->Primitives[Bin[Index]];
+        
+        int MinX = (Primitive->MinX > TileMinX) ? Primitive->MinX : TileMinX;
+        int MinY = (Primitive->MinY > TileMinY) ? Primitive->MinY : TileMinY;
+        int MaxX = (Primitive->MaxX < TileMaxX) ? Primitive->MaxX : TileMaxX;
+        int MaxY = (Primitive->MaxY < TileMaxY) ? Primitive->MaxY : TileMaxY;
+        if(MinX > MaxX || MinY > MaxY) continue;
+        
+        if(Primitive->Type == SOFTWARE_PRIMITIVE_TRIANGLE) {
+            SoftwareRasterizeTriangle(Primitive, MinX, MinY, MaxX, MaxY);
+        } else {
+            SoftwareRasterizeLine(Primitive, MinX, MinY, MaxX, MaxY);
+        }
+    }
+}
+
+void SoftwareRasterizeTiles() {
+    PROFILE_BEGIN("Rasterize");
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    for(;;) {
+        int Tile = (int)AtomicAdd(&Renderer->NextTile, 1) - 1;
+        if(Tile >= Renderer->TileCount) break;
+        if(Renderer->TileBinCounts[Tile] || Renderer->ClearPending) {
+            SoftwareRasterizeTile(Tile);
+        }
+    }
+    PROFILE_END();
+}
+
+void SoftwareWorker(void* Data) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    int Generation = 0;
+    
+    for(;;) {
+        MutexLock(&Renderer->Mutex);
+        while(Renderer->Generation == Generation) {
+            ConditionWait(&Renderer->WorkReady, &Renderer->Mutex);
+        }
+        Generation = Renderer->Generation;
+        MutexUnlock(&Renderer->Mutex);
+        
+        SoftwareRasterizeTiles();
+        
+        MutexLock(&Renderer->Mutex);
+        if(--Renderer->WorkersBusy == 0) {
+            ConditionBroadcast(&Renderer->WorkDone);
+        }
+        MutexUnlock(&Renderer->Mutex);
+    }
+}
+
+void SoftwareRendererInit(int Width, int Height, int ThreadCount) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    
+    Renderer->Width = Width;
+    Renderer->Height = Height;
+    Renderer->TilesX = (Width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    Renderer->TilesY = (Height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    Renderer->TileCount = Renderer->TilesX * Renderer->TilesY;
+    
+    Renderer->Pixels = MemoryAlloc(Width * Height * sizeof(u32));
+    Renderer->Primitives = MemoryAlloc(SOFTWARE_MAX_PRIMITIVES * sizeof(softwarePrimitive));
+    Renderer->TileBins = MemoryAlloc(Renderer->TileCount * SOFTWARE_MAX_TILE_PRIMITIVES * sizeof(int));
+    Renderer->TileBinCounts = MemoryAlloc(Renderer->TileCount * sizeof(int));
+    
+    for(int Index = 0; Index < 256; ++Index) {
+        float C = (float)Index / 255.0f;
+        Renderer->UnormToFloat[Index] = C;
+        Renderer->SrgbToLinear[Index] = (C <= 0.04045f) ? C / 12.92f : powf((C + 0.055f) / 1.055f, 2.4f);
+    }
+    
+    // The calling thread rasterizes too
+    
+    if(ThreadCount < 1) ThreadCount = 1;
+    if(ThreadCount > SOFTWARE_MAX_THREADS) ThreadCount = SOFTWARE_MAX_THREADS;
+    Renderer->ThreadCount = ThreadCount;
+    
+    MutexInit(&Renderer->Mutex);
+    ConditionInit(&Renderer->WorkReady);
+    ConditionInit(&Renderer->WorkDone);
+    
+    for(int Index = 1; Index < ThreadCount; ++Index) {
+        ThreadStart(&Renderer->Threads[Index], SoftwareWorker, NULL);
+    }
+}
+
+void SoftwareRendererClear(color Color) {
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    if(Renderer->PrimitiveCount) SoftwareRendererFlush();
+    Renderer->ClearColor = SoftwarePackColor(Color.R, Color.G, Color.B, Color.A);
+    Renderer->ClearPending = 1;
+}
+
+void SoftwareRendererFlush() {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    
+    Renderer->NextTile = 0;
+    
+    if(Renderer->ThreadCount > 1) {
+        MutexLock(&Renderer->Mutex);
+        Renderer->WorkersBusy = Renderer->ThreadCount - 1;
+        ++Renderer->Generation;
+        ConditionBroadcast(&Renderer->WorkReady);
+        MutexUnlock(&Renderer->Mutex);
+        
+        SoftwareRasterizeTiles();
+        
+        MutexLock(&Renderer->Mutex);
+        while(Renderer->WorkersBusy) {
+            ConditionWait(&Renderer->WorkDone, &Renderer->Mutex);
+        }
+        MutexUnlock(&Renderer->Mutex);
+    } else {
+        SoftwareRasterizeTiles();
+    }
+    
+    memset(Renderer->TileBinCounts, 0, Renderer->TileCount * sizeof(int));
+    Renderer->PrimitiveCount = 0;
+    Renderer->ClearPending = 0;
+}
+
+// Flushes first when the primitive or a tile bin is full
+void SoftwareBinPrimitive(softwarePrimitive* Primitive) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    
+    int MinTileX = Primitive->MinX / SOFTWARE_TILE_SIZE;
+    int MinTileY = Primitive->MinY / SOFTWARE_TILE_SIZE;
+    int MaxTileX = Primitive->MaxX / SOFTWARE_TILE_SIZE;
+    int MaxTileY = Primitive->MaxY / SOFTWARE_TILE_SIZE;
+    
+    int Full = (Renderer->PrimitiveCount >= SOFTWARE_MAX_PRIMITIVES);
+    for(int TileY = MinTileY; TileY <= MaxTileY && !Full; ++TileY) {
+        for(int TileX = MinTileX; TileX <= MaxTileX; ++TileX) {
+            if(Renderer->TileBinCounts[TileY * Renderer->TilesX + TileX] >= SOFTWARE_MAX_TILE_PRIMITIVES) {
+                Full = 1;
+                break;
+            }
+        }
+    }
+    if(Full) SoftwareRendererFlush();
+    
+    int Index = Renderer->PrimitiveCount++;
+    Renderer->Primitives[Index] = *Primitive;
+    
+    for(int TileY = MinTileY; TileY <= MaxTileY; ++TileY) {
+        for(int TileX = MinTileX; TileX <= MaxTileX; ++TileX) {
+            int Tile = TileY * Renderer->TilesX + TileX;
+            Renderer->TileBins[Tile * SOFTWARE_MAX_TILE_PRIMITIVES + Renderer->TileBinCounts[Tile]++] = Index;
+        }
+    }
+}
+
+// Vertex stage of DrawObject() and the default shaders
+void SoftwareRendererDraw(v3 Position, v3 Scale, float Rotation, color Color,
+                          int Mesh, int Texture, int Shader, int PrimitiveTopology) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    mesh* DrawMesh = &Meshes[Mesh];
+    
+    // Same matrices DrawObject() puts in the constant buffer
+    
+    float Theta = DegreesToRadians(Rotation);
+    matrix RotationMatrix = {
+        cos(Theta),  sin(Theta), 0.0f, 0.0f, 
+        -sin(Theta), cos(Theta), 0.0f, 0.0f, 
+        0.0f,        0.0f,       1.0f, 0.0f, 
+        0.0f,        0.0f,       0.0f, 1.0f, 
+    };
+    matrix ScaleMatrix = MatrixScale(Scale);
+    matrix ModelMatrix = MatrixTranslation(Position);
+    
+    // default_shaders_position.hlsl scales first, the uv shaders rotate first
+    
+    matrix Transform = (Shader == DEFAULT_SHADER_POSITION) ?
+        MatrixMultiply(&ScaleMatrix, &RotationMatrix) :
+        MatrixMultiply(&RotationMatrix, &ScaleMatrix);
+    Transform = MatrixMultiply(&Transform, &ModelMatrix);
+    Transform = MatrixMultiply(&Transform, &ViewMatrix);
+    Transform = MatrixMultiply(&Transform, &ProjectionMatrix);
+    
+    int Textured = (Texture && Shader != DEFAULT_SHADER_POSITION);
+    float USize = 1.0f;
+    float VSize = 1.0f;
+    float UOffset = 0.0f;
+    float VOffset = 0.0f;
+    if(Textured && Shader == DEFAULT_SHADER_POSITION_UV_ATLAS) {
+        textureInfo Uvs = SnapshotUvs(Texture);
+        USize = Uvs.USize;
+        VSize = Uvs.VSize;
+        UOffset = Uvs.UOffset * USize;
+        VOffset = Uvs.VOffset * VSize;
+    }
+    
+    int Stride = DrawMesh->Stride / sizeof(float);
+    int IsLine = (PrimitiveTopology == D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+    int VerticesPerPrimitive = IsLine ? 2 : 3;
+    
+    softwarePrimitive Primitive = {
+        .Type = IsLine ? SOFTWARE_PRIMITIVE_LINE : SOFTWARE_PRIMITIVE_TRIANGLE,
+        .Shader = Shader,
+        .Texture = Textured ? Texture : 0,
+        .Opaque = (!Textured && Color.A >= 1.0f),
+        .Color = Color,
+        .PackedColor = SoftwarePackColor(Color.R, Color.G, Color.B, Color.A),
+    };
+    
+    for(int First = 0; First + VerticesPerPrimitive <= DrawMesh->NumVertices; First += VerticesPerPrimitive) {
+        
+        float X[3], Y[3], InvW[3], U[3], V[3];
+        int Behind = 0;
+        
+        for(int Vertex = 0; Vertex < VerticesPerPrimitive; ++Vertex) {
+            float* Source = &DrawMesh->Vertices[(First + Vertex) * Stride];
+            float In[4] = {Source[0], Source[1], Source[2], 1.0f};
+            float Clip[4];
+            for(int Column = 0; Column < 4; ++Column) {
+                Clip[Column] = In[0] * Transform.M[0][Column] + In[1] * Transform.M[1][Column] +
+                    In[2] * Transform.M[2][Column] + In[3] * Transform.M[3][Column];
+            }
+            // No clipper, drop anything reaching behind the camera
+            if(Clip[3] <= FLT_EPSILON) {
+                Behind = 1;
+                break;
+            }
+            InvW[Vertex] = 1.0f / Clip[3];
+            // Snap to 1/256 pixel like the GPU's fixed point rasterizer
+            X[Vertex] = roundf((Clip[0] * InvW[Vertex] + 1.0f) * 0.5f * Renderer->Width * 256.0f) / 256.0f;
+            Y[Vertex] = roundf((1.0f - Clip[1] * InvW[Vertex]) * 0.5f * Renderer->Height * 256.0f) / 256.0f;
+            U[Vertex] = Textured ? Source[3] * USize + UOffset : 0.0f;
+            V[Vertex] = Textured ? Source[4] * VSize + VOffset : 0.0f;
+        }
+        if(Behind) continue;
+        
+        float MinX, MinY, MaxX, MaxY;
+        
+        if(IsLine) {
+            Primitive.X0 = X[0];
+            Primitive.Y0 = Y[0];
+            Primitive.X1 = X[1];
+            Primitive.Y1 = Y[1];
+            MinX = fminf(X[0], X[1]);
+            MaxX = fmaxf(X[0], X[1]);
+            MinY = fminf(Y[0], Y[1]);
+            MaxY = fmaxf(Y[0], Y[1]);
+            Primitive.MinX = (int)floorf(MinX);
+            Primitive.MinY = (int)floorf(MinY);
+            Primitive.MaxX = (int)floorf(MaxX);
+            Primitive.MaxY = (int)floorf(MaxY);
+        } else {
+            // Clockwise on screen is front facing, D3D culls the rest by default
+            float Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+            if(Area <= 0.0f) continue;
+            
+            // Edge opposite to each vertex, evaluated at pixel centers
+            for(int Edge = 0; Edge < 3; ++Edge) {
+                int I = (Edge + 1) % 3;
+                int J = (Edge + 2) % 3;
+                float A = Y[I] - Y[J];
+                float B = X[J] - X[I];
+                Primitive.EdgeA[Edge] = A;
+                Primitive.EdgeB[Edge] = B;
+                Primitive.EdgeC[Edge] = X[I] * Y[J] - X[J] * Y[I] + 0.5f * A + 0.5f * B;
+                Primitive.EdgeTopLeft[Edge] = (A > 0.0f || (A == 0.0f && B > 0.0f));
+                Primitive.InvW[Edge] = InvW[Edge];
+                Primitive.UW[Edge] = U[Edge] * InvW[Edge];
+                Primitive.VW[Edge] = V[Edge] * InvW[Edge];
+            }
+            
+            MinX = fminf(X[0], fminf(X[1], X[2]));
+            MaxX = fmaxf(X[0], fmaxf(X[1], X[2]));
+            MinY = fminf(Y[0], fminf(Y[1], Y[2]));
+            MaxY = fmaxf(Y[0], fmaxf(Y[1], Y[2]));
+            // Pixels whose center can be inside
+            Primitive.MinX = (int)ceilf(MinX - 0.5f);
+            Primitive.MinY = (int)ceilf(MinY - 0.5f);
+            Primitive.MaxX = (int)floorf(MaxX - 0.5f);
+            Primitive.MaxY = (int)floorf(MaxY - 0.5f);
+        }
+        
+        if(MaxX < 0.0f || MaxY < 0.0f || MinX > Renderer->Width || MinY > Renderer->Height) continue;
+        
+        if(Primitive.MinX < 0) Primitive.MinX = 0;
+        if(Primitive.MinY < 0) Primitive.MinY = 0;
+        if(Primitive.MaxX >= Renderer->Width) Primitive.MaxX = Renderer->Width - 1;
+        if(Primitive.MaxY >= Renderer->Height) Primitive.MaxY = Renderer->Height - 1;
+        if(Primitive.MinX > Primitive.MaxX || Primitive.MinY > Primitive.MaxY) continue;
+        
+        SoftwareBinPrimitive(&Primitive);
+    }
+}
+
+int WritePPM(const char* File, u32* Pixels, int Width, int Height) {
+    
+    FILE* Output = fopen(File, "wb");
+    if(!Output) return 0;
+    
+    fprintf(Output, "P6\n%d %d\n255\n", Width, Height);
+    for(int Index = 0; Index < Width * Height; ++Index) {
+        unsigned char RGB[3] = {
+            Pixels[Index] & 0xff,
+            (Pixels[Index] >> 8) & 0xff,
+            (Pixels[Index] >> 16) & 0xff,
+        };
+        fwrite(RGB, 1, 3, Output);
+    }
+    
+    fclose(Output);
+    return 1;
+}
+
+// One tick of the headless loop, in two halves so they can be timed apart
+
+void HeadlessUpdate() {
+    
+    int64_t Now = ClockNow();
+    
+    PROFILE_BEGIN("Input");
+    InputTick(Now);
+    Input();
+    HandleCamera();
+    PROFILE_END();
+    
+    PROFILE_BEGIN("Update");
+    RunTick();
+    PROFILE_END();
+}
+
+void HeadlessDraw() {
+    
+    PROFILE_BEGIN("Draw");
+    SoftwareRendererClear(EngineColorBackground);
+    ResetRenderState();
+    FrameBegin();
+    Draw();
+    PROFILE_END();
+    
+    PROFILE_BEGIN("Flush");
+    SoftwareRendererFlush();
+    PROFILE_END();
+}
+
+// Scenarios
+
+int ScenarioCompare(const void* A, const void* B) {
+    double X = *(const double*)A;
+    double Y = *(const double*)B;
+    return (X > Y) - (X < Y);
+}
+
+double ScenarioPerfRatio(double Count, double Per) {
+    return (Per > 0.0) ? Count / Per : 0.0;
+}
+
+// Runs Ticks ticks on simulated time with Script driving the input. The
+// game sets the scene up before calling this. Zone times need PROFILER,
+// hardware counters PerfOpen() too.
+void ScenarioRun(char* Name, int Ticks, scenarioScript* Script) {
+    
+    assert(ScenarioResultCount < MAX_SCENARIOS);
+    assert(Ticks > 0 && Ticks <= MAX_SCENARIO_TICKS);
+    
+    scenarioResult* Result = &ScenarioResults[ScenarioResultCount++];
+    *Result = (scenarioResult){ .Ticks = Ticks };
+    snprintf(Result->Name, sizeof(Result->Name), "%s", Name);
+    
+    double* Times = malloc(Ticks * sizeof(double));
+    assert(Times);
+    
+    double Total = 0.0;
+#ifdef PROFILER
+    double Previous[MAX_SCENARIO_ZONES] = {0};
+#endif
+    
+    CountersReset();
+    
+    for(int Tick = 0; Tick < Ticks; ++Tick) {
+        
+        SetTimer(&Timer, TicksToNanoseconds(Tick + 1));
+        Script(Tick);
+        Result->EntityTicks += ScenarioEntities;
+        
+#ifdef PROFILER
+        long ZoneStart = ProfileThread->Head;
+#endif
+        
+        // Only the game's allocations, not the script's or ours
+        
+        long Allocations = AllocAudit.Allocations;
+        AllocAudit.Armed = AllocAudit.Enabled;
+        
+        int64_t Start = ClockNow();
+        int64_t End;
+        
+        HeadlessUpdate();
+        HeadlessDraw();
+        
+        End = ClockNow();
+        AllocAudit.Armed = 0;
+        Result->Allocations += AllocAudit.Allocations - Allocations;
+        Times[Tick] = NanosecondsToMilliseconds(End - Start);
+        Total += Times[Tick];
+        
+#ifdef PROFILER
+        ProfileSumZones(ZoneStart, ProfileThread->Head, Result->Zones, &Result->ZoneCount, MAX_SCENARIO_ZONES);
+        
+        for(int Index = 0; Index < Result->ZoneCount; ++Index) {
+            scenarioZone* Zone = &Result->Zones[Index];
+            if(!Zone->Samples) {
+                Zone->Samples = calloc(Ticks, sizeof(double));
+                assert(Zone->Samples);
+            }
+            Zone->Samples[Tick] = Zone->Milliseconds - Previous[Index];
+            Previous[Index] = Zone->Milliseconds;
+        }
+#endif
+    }
+    
+    qsort(Times, Ticks, sizeof(double), ScenarioCompare);
+    
+    Result->TicksPerSecond = Ticks * 1000.0 / Total;
+    Result->P50 = Times[(Ticks * 50 + 99) / 100 - 1];
+    Result->P95 = Times[(Ticks * 95 + 99) / 100 - 1];
+    Result->P99 = Times[(Ticks * 99 + 99) / 100 - 1];
+    Result->Max = Times[Ticks - 1];
+    Result->Samples = Times;
+    Result->Counters = Counters.Stats;
+    
+    for(int Index = 0; Index < Result->ZoneCount; ++Index) {
+        Result->Zones[Index].Milliseconds /= Ticks;
+    }
+    
+    Debug("%-16s %6d ticks %9.0f ticks/s  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f ms\n",
+          Result->Name, Ticks, Result->TicksPerSecond,
+          Result->P50, Result->P95, Result->P99, Result->Max);
+#ifdef ALLOC_AUDIT
+    Debug("  %ld allocations in %d ticks%s\n", Result->Allocations, Ticks,
+          Result->Allocations ? ", steady state should have none" : "");
+#endif
+    for(int Index = 0; Index < Result->ZoneCount; ++Index) {
+        scenarioZone* Zone = &Result->Zones[Index];
+        Debug("  %-14s %.4f ms/tick", Zone->Name, Zone->Milliseconds);
+        if(Perf.Opened[PERF_CYCLES] && Perf.Opened[PERF_INSTRUCTIONS]) {
+            Debug("  ipc %.2f", ScenarioPerfRatio(Zone->Perf[PERF_INSTRUCTIONS], Zone->Perf[PERF_CYCLES]));
+        }
+        if(Perf.Opened[PERF_CACHE_MISSES]) {
+            Debug("  cache misses %.2f/entity", ScenarioPerfRatio(Zone->Perf[PERF_CACHE_MISSES], Result->EntityTicks));
+        }
+        if(Perf.Opened[PERF_BRANCH_MISSES]) {
+            Debug("  branch misses %.2f/entity", ScenarioPerfRatio(Zone->Perf[PERF_BRANCH_MISSES], Result->EntityTicks));
+        }
+        Debug("\n");
+    }
+    CountersPrint(&Result->Counters);
+}
+
+// Writes the results as JSON. Returns 0 on failure.
+int ScenarioWrite(const char* File) {
+    
+    FILE* Handle = fopen(File, "w");
+    if(!Handle) {
+        Debug("%s: can't write results\n", File);
+        return 0;
+    }
+    
+    fprintf(Handle, "{\n  \"unit\": \"ms\",\n  \"scenarios\": [\n");
+    
+    for(int Index = 0; Index < ScenarioResultCount; ++Index) {
+        scenarioResult* Result = &ScenarioResults[Index];
+        fprintf(Handle, "    {\"name\": \"%s\", \"ticks\": %d, \"ticks_per_second\": %.1f, "
+                "\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"zones\": {",
+                Result->Name, Result->Ticks, Result->TicksPerSecond,
+                Result->P50, Result->P95, Result->P99, Result->Max);
+        for(int Zone = 0; Zone < Result->ZoneCount; ++Zone) {
+            fprintf(Handle, "%s\"%s\": %.4f", Zone ? ", " : "",
+                    Result->Zones[Zone].Name, Result->Zones[Zone].Milliseconds);
+        }
+        fprintf(Handle, "}, \"samples\": [");
+        for(int Tick = 0; Tick < Result->Ticks; ++Tick) {
+            fprintf(Handle, "%s%.4f", Tick ? "," : "", Result->Samples[Tick]);
+        }
+        fprintf(Handle, "], \"zone_samples\": {");
+        for(int Zone = 0; Zone < Result->ZoneCount; ++Zone) {
+            fprintf(Handle, "%s\"%s\": [", Zone ? ", " : "", Result->Zones[Zone].Name);
+            for(int Tick = 0; Tick < Result->Ticks; ++Tick) {
+                fprintf(Handle, "%s%.4f", Tick ? "," : "", Result->Zones[Zone].Samples[Tick]);
+            }
+            fprintf(Handle, "]");
+        }
+        
+        // Hardware counters per tick, misses per live entity
+        
+        fprintf(Handle, "}, \"entities_per_tick\": %.1f, \"zone_perf\": {",
+                Result->EntityTicks / Result->Ticks);
+        for(int Zone = 0; Zone < Result->ZoneCount && Perf.Group != -1; ++Zone) {
+            scenarioZone* Info = &Result->Zones[Zone];
+            fprintf(Handle, "%s\"%s\": {\"cycles\": %.0f, \"instructions\": %.0f, \"ipc\": %.3f, "
+                    "\"cache_misses_per_entity\": %.4f, \"branch_misses_per_entity\": %.4f}",
+                    Zone ? ", " : "", Info->Name,
+                    (double)Info->Perf[PERF_CYCLES] / Result->Ticks,
+                    (double)Info->Perf[PERF_INSTRUCTIONS] / Result->Ticks,
+                    ScenarioPerfRatio(Info->Perf[PERF_INSTRUCTIONS], Info->Perf[PERF_CYCLES]),
+                    ScenarioPerfRatio(Info->Perf[PERF_CACHE_MISSES], Result->EntityTicks),
+                    ScenarioPerfRatio(Info->Perf[PERF_BRANCH_MISSES], Result->EntityTicks));
+        }
+        
+        // Histograms are keyed by each bucket's smallest count
+        
+        counterStats* Stats = &Result->Counters;
+        fprintf(Handle, "}, \"counters\": {");
+        for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+            fprintf(Handle, "%s\"%s\": {\"total\": %ld, \"max\": %ld, \"histogram\": {",
+                    Counter ? ", " : "", Counters.Names[Counter], Stats->Total[Counter], Stats->Max[Counter]);
+            int First = 1;
+            for(int Bucket = 0; Bucket < COUNTER_BUCKETS; ++Bucket) {
+                if(!Stats->Histogram[Counter][Bucket]) continue;
+                fprintf(Handle, "%s\"%ld\": %d", First ? "" : ", ",
+                        Bucket ? 1L << (Bucket - 1) : 0L, Stats->Histogram[Counter][Bucket]);
+                First = 0;
+            }
+            fprintf(Handle, "}}");
+        }
+        fprintf(Handle, "}}%s\n", (Index + 1 < ScenarioResultCount) ? "," : "");
+    }
+    
+    fprintf(Handle, "  ]\n}\n");
+    
+    if(fclose(Handle) != 0) {
+        Debug("%s: write failed\n", File);
+        return 0;
+    }
+    
+    return 1;
+}
+
+// Regression gate
+
+char* JsonSkip(char* At) {
+    while(*At == ' ' || *At == '\t' || *At == '\r' || *At == '\n') ++At;
+    return At;
+}
+
+// Parses in place, terminating strings inside Text. Escapes are left as
+// they are. Returns the text after the value, NULL on a syntax error.
+char* JsonParse(char* At, jsonValue* Value) {
+    
+    At = JsonSkip(At);
+    *Value = (jsonValue){0};
+    
+    if(*At == '{' || *At == '[') {
+        char Close = (*At == '{') ? '}' : ']';
+        Value->Type = (*At == '{') ? JSON_OBJECT : JSON_ARRAY;
+        int Capacity = 0;
+        
+        At = JsonSkip(At + 1);
+        if(*At == Close) return At + 1;
+        
+        for(;;) {
+            char* Key = NULL;
+            if(Value->Type == JSON_OBJECT) {
+                jsonValue KeyValue;
+                At = JsonParse(At, &KeyValue);
+                if(!At || KeyValue.Type != JSON_STRING) return NULL;
+                At = JsonSkip(At);
+                if(*At++ != ':') return NULL;
+                Key = KeyValue.String;
+            }
+            
+            if(Value->Count == Capacity) {
+                Capacity = Capacity ? Capacity * 2 : 16;
+                Value->Items = realloc(Value->Items, Capacity * sizeof(jsonValue));
+                assert(Value->Items);
+            }
+            
+            jsonValue* Item = &Value->Items[Value->Count++];
+            At = JsonParse(At, Item);
+            if(!At) return NULL;
+            Item->Key = Key;
+            
+            At = JsonSkip(At);
+            if(*At == ',') {
+                ++At;
+            } else if(*At == Close) {
+                return At + 1;
+            } else {
+                return NULL;
+            }
+        }
+    }
+    
+    if(*At == '"') {
+        Value->Type = JSON_STRING;
+        Value->String = ++At;
+        while(*At && *At != '"') {
+            if(*At == '\\' && At[1]) ++At;
+            ++At;
+        }
+        if(!*At) return NULL;
+        *At = 0;
+        return At + 1;
+    }
+    
+    // Booleans read as 0 and 1
+    
+    if(!strncmp(At, "null", 4)) {
+        return At + 4;
+    }
+    
+    if(!strncmp(At, "true", 4)) {
+        Value->Type = JSON_NUMBER;
+        Value->Number = 1.0;
+        return At + 4;
+    }
+    
+    if(!strncmp(At, "false", 5)) {
+        Value->Type = JSON_NUMBER;
+        return At + 5;
+    }
+    
+    char* End;
+    Value->Type = JSON_NUMBER;
+    Value->Number = strtod(At, &End);
+    return (End == At) ? NULL : End;
+}
+
+jsonValue* JsonFind(jsonValue* Object, const char* Key) {
+    for(int Index = 0; Index < Object->Count; ++Index) {
+        if(Object->Items[Index].Key && !strcmp(Object->Items[Index].Key, Key)) {
+            return &Object->Items[Index];
+        }
+    }
+    return NULL;
+}
+
+void CompareAdd(compareSet* Set, const char* Name, jsonValue* Samples) {
+    
+    compareMetric* Metric = NULL;
+    for(int Index = 0; Index < Set->Count; ++Index) {
+        if(!strcmp(Set->Metrics[Index].Name, Name)) Metric = &Set->Metrics[Index];
+    }
+    
+    if(!Metric) {
+        Set->Metrics = realloc(Set->Metrics, (Set->Count + 1) * sizeof(compareMetric));
+        assert(Set->Metrics);
+        Metric = &Set->Metrics[Set->Count++];
+        *Metric = (compareMetric){0};
+        snprintf(Metric->Name, sizeof(Metric->Name), "%s", Name);
+    }
+    
+    Metric->Samples = realloc(Metric->Samples, (Metric->Count + Samples->Count) * sizeof(double));
+    Metric->Runs = realloc(Metric->Runs, (Metric->RunCount + 1) * sizeof(double));
+    assert(Metric->Samples && Metric->Runs);
+    
+    double* Run = &Metric->Samples[Metric->Count];
+    for(int Index = 0; Index < Samples->Count; ++Index) {
+        Metric->Samples[Metric->Count++] = Samples->Items[Index].Number;
+    }
+    
+    qsort(Run, Samples->Count, sizeof(double), ScenarioCompare);
+    Metric->Runs[Metric->RunCount++] = Run[Samples->Count / 2];
+}
+
+// Every array of numbers becomes a metric named after the objects around
+// it: "name" and "count" when they have them, plus the array's key unless
+// it's "samples". Works for both BenchWrite and ScenarioWrite output.
+void CompareCollect(compareSet* Set, jsonValue* Value, const char* Label) {
+    
+    if(Value->Type == JSON_ARRAY) {
+        for(int Index = 0; Index < Value->Count; ++Index) {
+            CompareCollect(Set, &Value->Items[Index], Label);
+        }
+        return;
+    }
+    
+    if(Value->Type != JSON_OBJECT) return;
+    
+    char Own[128];
+    snprintf(Own, sizeof(Own), "%s", Label);
+    
+    jsonValue* Name = JsonFind(Value, "name");
+    jsonValue* Count = JsonFind(Value, "count");
+    if(Name && Name->Type == JSON_STRING) {
+        snprintf(Own, sizeof(Own), "%s%s%s", Label, *Label ? "/" : "", Name->String);
+    }
+    if(Count && Count->Type == JSON_NUMBER) {
+        size_t Length = strlen(Own);
+        snprintf(Own + Length, sizeof(Own) - Length, "/%d", (int)Count->Number);
+    }
+    
+    for(int Index = 0; Index < Value->Count; ++Index) {
+        jsonValue* Item = &Value->Items[Index];
+        if(Item->Type == JSON_ARRAY && Item->Count > 0 && Item->Items[0].Type == JSON_NUMBER) {
+            if(!strcmp(Item->Key, "samples")) {
+                CompareAdd(Set, Own, Item);
+            } else {
+                char Child[128];
+                snprintf(Child, sizeof(Child), "%s/%s", Own, Item->Key);
+                CompareAdd(Set, Child, Item);
+            }
+        } else {
+            CompareCollect(Set, Item, Own);
+        }
+    }
+}
+
+// Loads a comma separated list of results files into Set. Repeated runs
+// of the same thing pool their samples.
+int CompareLoad(compareSet* Set, char* Files) {
+    
+    char List[1024];
+    snprintf(List, sizeof(List), "%s", Files);
+    
+    for(char* File = strtok(List, ","); File; File = strtok(NULL, ",")) {
+        
+        FILE* Handle = fopen(File, "rb");
+        if(!Handle) {
+            Debug("%s: can't open\n", File);
+            return 0;
+        }
+        
+        fseek(Handle, 0, SEEK_END);
+        long Size = ftell(Handle);
+        fseek(Handle, 0, SEEK_SET);
+        
+        char* Text = malloc(Size + 1);
+        assert(Text);
+        size_t Read = fread(Text, 1, Size, Handle);
+        fclose(Handle);
+        Text[Read] = 0;
+        
+        // The text and the tree stay alive, metrics copy what they need
+        jsonValue Root;
+        if(!JsonParse(Text, &Root)) {
+            Debug("%s: not valid JSON\n", File);
+            return 0;
+        }
+        
+        CompareCollect(Set, &Root, "");
+    }
+    
+    return 1;
+}
+
+// Sorts Samples and returns their median
+double CompareMedian(double* Samples, int Count) {
+    qsort(Samples, Count, sizeof(double), ScenarioCompare);
+    return Samples[Count / 2];
+}
+
+// One sided Mann-Whitney U test with the normal approximation and a tie
+// correction. Returns the probability of Current being this much slower
+// than Baseline by chance. Both arrays must be sorted.
+double CompareMannWhitney(double* Baseline, int BaselineCount, double* Current, int CurrentCount) {
+    
+    double N1 = BaselineCount;
+    double N2 = CurrentCount;
+    double N = N1 + N2;
+    
+    // Walks both sorted arrays in step, ranking runs of equal values with
+    // their average rank
+    
+    double RankSum = 0.0;
+    double Ties = 0.0;
+    int A = 0;
+    int B = 0;
+    
+    while(A < BaselineCount || B < CurrentCount) {
+        double Value = (B >= CurrentCount || (A < BaselineCount && Baseline[A] < Current[B]))
+            ? Baseline[A] : Current[B];
+        
+        int FromBaseline = 0;
+        int FromCurrent = 0;
+        while(A < BaselineCount && Baseline[A] == Value) ++A, ++FromBaseline;
+        while(B < CurrentCount && Current[B] == Value) ++B, ++FromCurrent;
+        
+        double Run = FromBaseline + FromCurrent;
+        double FirstRank = A + B - Run + 1;
+        RankSum += FromCurrent * (FirstRank + (Run - 1) / 2.0);
+        Ties += Run * Run * Run - Run;
+    }
+    
+    double U = RankSum - N2 * (N2 + 1) / 2.0;
+    double Mean = N1 * N2 / 2.0;
+    double Variance = N1 * N2 / 12.0 * ((N + 1) - Ties / (N * (N - 1)));
+    if(Variance <= 0.0) return 1.0;
+    
+    double Z = (U - Mean) / sqrt(Variance);
+    return 0.5 * erfc(Z / sqrt(2.0));
+}
+
+// Compares the medians of every metric in both sets of results files. A
+// metric regresses when its median is Threshold (0.05 = 5%) slower and
+// the difference is significant at Alpha. Returns the regression count.
+// Samples from one process share its luck (clock speed, cache, whatever
+// else was running), so with COMPARE_MIN_RUNS or more files on each side
+// the test is on the per file medians instead of the pooled samples.
+int CompareRuns(char* Baseline, char* Current, double Threshold, double Alpha) {
+    
+    compareSet Before = {0};
+    compareSet After = {0};
+    
+    if(!CompareLoad(&Before, Baseline) || !CompareLoad(&After, Current)) return -1;
+    
+    int Regressions = 0;
+    int Missing = 0;
+    int Pooled = 0;
+    
+    Debug("%-36s %12s %12s %8s %8s\n", "metric", "baseline", "current", "change", "p");
+    
+    for(int Index = 0; Index < Before.Count; ++Index) {
+        
+        compareMetric* Old = &Before.Metrics[Index];
+        compareMetric* New = NULL;
+        for(int Other = 0; Other < After.Count; ++Other) {
+            if(!strcmp(After.Metrics[Other].Name, Old->Name)) New = &After.Metrics[Other];
+        }
+        
+        if(!New) {
+            Debug("%-36s %12.4f %12s\n", Old->Name, CompareMedian(Old->Samples, Old->Count), "missing");
+            ++Missing;
+            continue;
+        }
+        
+        double OldMedian = CompareMedian(Old->Samples, Old->Count);
+        double NewMedian = CompareMedian(New->Samples, New->Count);
+        double Change = (OldMedian > 0.0) ? (NewMedian - OldMedian) / OldMedian : 0.0;
+        
+        double P;
+        if(Old->RunCount >= COMPARE_MIN_RUNS && New->RunCount >= COMPARE_MIN_RUNS) {
+            CompareMedian(Old->Runs, Old->RunCount);
+            CompareMedian(New->Runs, New->RunCount);
+            P = CompareMannWhitney(Old->Runs, Old->RunCount, New->Runs, New->RunCount);
+        } else {
+            P = CompareMannWhitney(Old->Samples, Old->Count, New->Samples, New->Count);
+            ++Pooled;
+        }
+        
+        const char* Verdict = "";
+        if(Change > Threshold && P < Alpha) {
+            Verdict = "REGRESSED";
+            ++Regressions;
+        } else if(Change < -Threshold && 1.0 - P < Alpha) {
+            Verdict = "faster";
+        }
+        
+        Debug("%-36s %12.4f %12.4f %+7.1f%% %8.4f  %s\n",
+              Old->Name, OldMedian, NewMedian, Change * 100.0, P, Verdict);
+    }
+    
+    Debug("%d metrics, %d regressed, %d missing (threshold %.1f%%, alpha %g)\n",
+          Before.Count, Regressions, Missing, Threshold * 100.0, Alpha);
+    
+    if(Pooled) {
+        Debug("%d metrics had fewer than %d runs a side, their p values only cover the noise within a run\n",
+              Pooled, COMPARE_MIN_RUNS);
+    }
+    
+    return Regressions;
+}
+
+// Golden images
+
+// Compares the current frame against <Directory>/frame_<Frame>.ppm (or
+// writes it when updating). A pixel differs when any channel is off by
+// more than Tolerance. Failing frames leave the actual image and a
+// heatmap of the differences next to the golden.
+int GoldenCheck(char* Directory, int Frame, int Update, int Tolerance, int MaxDiffPixels) {
+    
+    softwareRenderer* Renderer = &SoftwareRenderer;
+    char File[512];
+    snprintf(File, sizeof(File), "%s/frame_%04d.ppm", Directory, Frame);
+    
+    if(Update) {
+        if(!WritePPM(File, Renderer->Pixels, Renderer->Width, Renderer->Height)) {
+            Debug("golden: can't write %s\n", File);
+            return 0;
+        }
+        return 1;
+    }
+    
+    int Width, Height, Channels;
+    unsigned char* Golden = stbi_load(File, &Width, &Height, &Channels, 3);
+    if(!Golden) {
+        Debug("golden: missing %s\n", File);
+        return 0;
+    }
+    if(Width != Renderer->Width || Height != Renderer->Height) {
+        Debug("golden: %s is %dx%d, frame is %dx%d\n", File, Width, Height, Renderer->Width, Renderer->Height);
+        stbi_image_free(Golden);
+        return 0;
+    }
+    
+    u32* Heatmap = malloc(Width * Height * sizeof(u32));
+    int DiffPixels = 0;
+    int MaxDelta = 0;
+    
+    for(int Index = 0; Index < Width * Height; ++Index) {
+        u32 Pixel = Renderer->Pixels[Index];
+        int Delta = 0;
+        for(int Channel = 0; Channel < 3; ++Channel) {
+            int ChannelDelta = abs((int)((Pixel >> (Channel * 8)) & 0xff) - (int)Golden[Index * 3 + Channel]);
+            if(ChannelDelta > Delta) Delta = ChannelDelta;
+        }
+        if(Delta > MaxDelta) MaxDelta = Delta;
+        if(Delta > Tolerance) ++DiffPixels;
+        
+        // Black where equal, dark red within tolerance, red to yellow above
+        u32 Red = (Delta > Tolerance || Delta * 32 > 255) ? 255 : (u32)Delta * 32;
+        u32 Green = (Delta > Tolerance) ? (u32)Delta : 0;
+        Heatmap[Index] = Red | (Green << 8) | 0xff000000;
+    }
+    
+    int Passed = (DiffPixels <= MaxDiffPixels);
+    
+    Debug("golden: frame %d %s, %d pixels over tolerance %d, max delta %d\n",
+          Frame, Passed ? "ok" : "FAILED", DiffPixels, Tolerance, MaxDelta);
+    
+    if(!Passed) {
+        snprintf(File, sizeof(File), "%s/frame_%04d_actual.ppm", Directory, Frame);
+        WritePPM(File, Renderer->Pixels, Width, Height);
+        snprintf(File, sizeof(File), "%s/frame_%04d_diff.ppm", Directory, Frame);
+        WritePPM(File, Heatmap, Width, Height);
+    }
+    
+    free(Heatmap);
+    stbi_image_free(Golden);
+    return Passed;
+}
+
+#endif
+
+// Misc
+
+// Note: creates a mesh every iteration, for testing
+/*
+void DrawRectangle(rectangle* R, color Color) {
+    
+    float RectangleLinesVertexData[] = {
+        R->Left, R->Bottom, 0.0f,
+        R->Left, R->Top, 0.0f,
+        R->Left, R->Top, 0.0f,
+        R->Right, R->Top, 0.0f, 
+        R->Right, R->Top, 0.0f,
+        R->Right, R->Bottom, 0.0f,
+        R->Right, R->Bottom, 0.0f,
+        R->Left, R->Bottom, 0.0f,
+    };
+    
+    TestRectangleMesh = CreateMesh(RectangleLinesVertexData, sizeof(RectangleLinesVertexData),
+                                   3, 0, 0);
+    
+    DrawObject((v3){0.0f, 0.0f, 0.0f},
+               (v3){1.0f, 1.0f, 1.0f},
+               0.0f,
+               Color,
+               TestRectangleMesh,
+               0,
+               DEFAULT_SHADER_POSITION,
+               1,
+               DEFAULT_INPUT_LAYOUT_POSITION,
+               D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+}
+*/
+
+int PickMeshRectangle(int MouseX, int MouseY, v3 Position, mesh* Mesh) {
+    
+    int Result = 0;
+    float X = ((2.0f * (float)MouseX) / (float)ClientWidth) - 1.0f;
+    float Y = (((2.0f * (float)MouseY) / (float)ClientHeight) - 1.0f) * -1.0f;
+    
+    X = X / ProjectionMatrix.M[0][0];
+    Y = Y / ProjectionMatrix.M[1][1];
+    
+    matrix InverseViewMatrix = {0};
+    MatrixInverse(&ViewMatrix, &InverseViewMatrix);
+    
+    v3 Direction = {0};
+    Direction.X = X * InverseViewMatrix.M[0][0] + Y * InverseViewMatrix.M[1][0] + InverseViewMatrix.M[2][0];
+    Direction.Y = X * InverseViewMatrix.M[0][1] + Y * InverseViewMatrix.M[1][1] + InverseViewMatrix.M[2][1];
+    Direction.Z = X * InverseViewMatrix.M[0][2] + Y * InverseViewMatrix.M[1][2] + InverseViewMatrix.M[2][2];
+    
+    v3 Origin = Camera.Position;
     matrix TranslatedModel = MatrixTranslation(Position);
     
-    matrix InverseModel = {0};
-    MatrixInverse(&TranslatedModel, &InverseModel);
+    matrix InverseModel = {0};
+    MatrixInverse(&TranslatedModel, &InverseModel);
+    
+    v3 RayOrigin = V3TransformCoord(&Origin, &InverseModel);
+    v3 RayDirection = V3TransformNormal(&Direction, &InverseModel);
+    
+    V3Normalize(&RayDirection);
+    
+    triangle Triangle1 = {
+        .A = {
+            Mesh->Vertices[0], 
+            Mesh->Vertices[1], 
+            Mesh->Vertices[2]
+        },
+        .B = {
+            Mesh->Vertices[5], 
+            Mesh->Vertices[6], 
+            Mesh->Vertices[7]
+        },
+        .C = {
+            Mesh->Vertices[10], 
+            Mesh->Vertices[11], 
+            Mesh->Vertices[12]
+        }
+    };
+    
+    triangle Triangle2 = {
+        .A = {
+            Mesh->Vertices[15], 
+            Mesh->Vertices[16], 
+            Mesh->Vertices[17]
+        },
+        .B = {
+            Mesh->Vertices[20], 
+            Mesh->Vertices[21], 
+            Mesh->Vertices[22]
+        },
+        .C = {
+            Mesh->Vertices[25], 
+            Mesh->Vertices[26], 
+            Mesh->Vertices[27]
+        }
+    };
+    
+    if(RayTriangleIntersect(RayOrigin, RayDirection, &Triangle1) || RayTriangleIntersect(RayOrigin, RayDirection, &Triangle2)) {
+        Result = 1;
+    }
+    
+    return Result;
+}
+
+
+void DrawString(v3 Position, char* String, color Color, v3 Scale) {
+    
+    v3 NewPosition = Position;
+    
+    // The render thread owns the font's uvs, glyphs are recorded with theirs
+    
+    if(SnapshotRecording) {
+        texture* Font = &Textures[DEFAULT_TEXTURE_FONT];
+        for(; *String; ++String) {
+            SnapshotAdd(NewPosition, Scale, 0.0f, Color, DEFAULT_MESH_RECTANGLE_UV, DEFAULT_TEXTURE_FONT,
+                        DEFAULT_SHADER_POSITION_UV_ATLAS, 0, DEFAULT_INPUT_LAYOUT_POSITION_UV,
+                        D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+                        Font->AtlasUOffset + *String % 16, Font->AtlasVOffset + *String / 16);
+            NewPosition.X += Scale.X;
+        }
+        return;
+    }
+    
+    while(*String) {
+        
+        Textures[DEFAULT_TEXTURE_FONT].UOffset = Textures[DEFAULT_TEXTURE_FONT].AtlasUOffset + *String % 16;
+        Textures[DEFAULT_TEXTURE_FONT].VOffset = Textures[DEFAULT_TEXTURE_FONT].AtlasVOffset + *String / 16;
+        
+        DrawObject(NewPosition, 
+                   Scale,
+                   0.0f,
+                   Color,
+                   DEFAULT_MESH_RECTANGLE_UV,
+                   DEFAULT_TEXTURE_FONT,
+                   DEFAULT_SHADER_POSITION_UV_ATLAS,
+                   0,
+                   DEFAULT_INPUT_LAYOUT_POSITION_UV,
+                   D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        ++String;
+        NewPosition.X += Scale.X;
+    }
+}
+
+// Text batch
+
+// Queues String like DrawString() but TextBatchFlush() draws every glyph
+// queued with one draw call. A different color flushes first.
+void TextBatchAdd(v3 Position, char* String, color Color, v3 Scale) {
+    
+    if(TextBatch.GlyphCount && memcmp(&Color, &TextBatch.Color, sizeof(color))) {
+        TextBatchFlush();
+    }
+    TextBatch.Color = Color;
+    
+    // DEFAULT_MESH_RECTANGLE_UV's corners
+    static const float Corners[6][4] = {
+        {-0.5f, -0.5f, 0.0f, 1.0f},
+        {-0.5f, 0.5f,  0.0f, 0.0f},
+        {0.5f, 0.5f,   1.0f, 0.0f},
+        {-0.5f, -0.5f, 0.0f, 1.0f},
+        {0.5f, 0.5f,   1.0f, 0.0f},
+        {0.5f, -0.5f,  1.0f, 1.0f},
+    };
+    
+    texture* Font = &Textures[DEFAULT_TEXTURE_FONT];
+    
+    for(; *String; ++String) {
+        
+        float U = Font->AtlasUOffset + *String % 16;
+        float V = Font->AtlasVOffset + *String / 16;
+        float* Vertex = TextBatchGlyph();
+        
+        for(int Corner = 0; Corner < 6; ++Corner) {
+            *Vertex++ = Position.X + Corners[Corner][0] * Scale.X;
+            *Vertex++ = Position.Y + Corners[Corner][1] * Scale.Y;
+            *Vertex++ = Position.Z;
+            *Vertex++ = (Corners[Corner][2] + U) * Font->USize;
+            *Vertex++ = (Corners[Corner][3] + V) * Font->VSize;
+        }
+        
+        Position.X += Scale.X;
+    }
+}
+
+// Where the next glyph's vertices go, flushing first when full. The text
+// mesh belongs to the render thread, so recording fills the snapshot's.
+float* TextBatchGlyph() {
+    
+    renderSnapshot* Snapshot = SnapshotRecording;
+    float* Vertices = Snapshot ? Snapshot->TextVertices : Meshes[DEFAULT_MESH_TEXT].Vertices;
+    int First = Snapshot ? Snapshot->TextGlyphs : 0;
+    
+    if(First + TextBatch.GlyphCount == MAX_TEXT_GLYPHS) {
+        TextBatchFlush();
+        First = Snapshot ? Snapshot->TextGlyphs : 0;
+        assert(First < MAX_TEXT_GLYPHS);
+    }
+    
+    return &Vertices[(First + TextBatch.GlyphCount++) * 6 * 5];
+}
+
+void TextBatchFlush() {
+    
+    if(!TextBatch.GlyphCount) return;
+    
+    // Recorded as one item, the render thread uploads its glyphs before
+    // drawing it. Either way the uvs already point into the atlas.
+    
+    renderSnapshot* Snapshot = SnapshotRecording;
+    if(Snapshot) {
+        renderItem* Item = SnapshotAdd((v3){0.0f, 0.0f, 0.0f}, (v3){1.0f, 1.0f, 1.0f}, 0.0f, TextBatch.Color,
+                                       DEFAULT_MESH_TEXT, DEFAULT_TEXTURE_FONT, DEFAULT_SHADER_POSITION_UV_ATLAS,
+                                       0, DEFAULT_INPUT_LAYOUT_POSITION_UV,
+                                       D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, 0.0f, 0.0f);
+        Item->USize = 1.0f;
+        Item->VSize = 1.0f;
+        Item->FirstGlyph = Snapshot->TextGlyphs;
+        Item->Glyphs = TextBatch.GlyphCount;
+        Snapshot->TextGlyphs += TextBatch.GlyphCount;
+        TextBatch.GlyphCount = 0;
+        return;
+    }
+    
+    MeshUpload(DEFAULT_MESH_TEXT, TextBatch.GlyphCount * 6);
+    
+    // The uvs already point into the atlas
+    
+    texture* Font = &Textures[DEFAULT_TEXTURE_FONT];
+    texture Saved = *Font;
+    Font->UOffset = 0.0f;
+    Font->VOffset = 0.0f;
+    Font->USize = 1.0f;
+    Font->VSize = 1.0f;
+    
+    DrawObject((v3){0.0f, 0.0f, 0.0f},
+               (v3){1.0f, 1.0f, 1.0f},
+               0.0f,
+               TextBatch.Color,
+               DEFAULT_MESH_TEXT,
+               DEFAULT_TEXTURE_FONT,
+               DEFAULT_SHADER_POSITION_UV_ATLAS,
+               0,
+               DEFAULT_INPUT_LAYOUT_POSITION_UV,
+               D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    
+    *Font = Saved;
+    TextBatch.GlyphCount = 0;
+}
+
+// HUD
+
+// Called by FrameBegin()
+void HudFrame() {
+    
+    if(!Hud.Timer.Start) InitTimer(&Hud.Timer);
+    
+    UpdateTimer(&Hud.Timer);
+    Hud.FrameTimes[Hud.FrameIndex] = Hud.Timer.ElapsedMilliSeconds - Hud.LastFrame;
+    Hud.FrameIndex = (Hud.FrameIndex + 1) % HUD_HISTORY;
+    Hud.LastFrame = Hud.Timer.ElapsedMilliSeconds;
+    
+    long Ticks = AtomicAdd(&Hud.Ticks, 0);
+    AtomicAdd(&Hud.Ticks, -Ticks);
+    Hud.TicksPerFrame = (int)Ticks;
+}
+
+// On the thread that draws the frames
+void HudFramesCopy(hudFrames* Frames) {
+    memcpy(Frames->FrameTimes, Hud.FrameTimes, sizeof(Frames->FrameTimes));
+    Frames->FrameIndex = Hud.FrameIndex;
+    Frames->TicksPerFrame = Hud.TicksPerFrame;
+    Frames->Percentiles[0] = HistogramPercentile(&FrameStats.Frames, 50.0);
+    Frames->Percentiles[1] = HistogramPercentile(&FrameStats.Frames, 99.0);
+    Frames->Percentiles[2] = HistogramPercentile(&FrameStats.Frames, 99.9);
+    Frames->RenderStats = FrameRenderStats;
+    Frames->FrameMilliseconds = FrameStats.FrameMilliseconds;
+}
+
+// Starts the overlay with its top left at Position & Scale sized glyphs,
+// with the engine's lines first: frame times & their graph, ticks, last
+// frame's render stats, arena use and the counters. Add lines with
+// HudPrint(), then HudEnd().
+void HudBegin(v3 Position, v3 Scale) {
+    
+    Hud.Cursor = Position;
+    Hud.Scale = Scale;
+    
+    // Recording uses the frames as of the last publish
+    
+    hudFrames Frames;
+    if(SnapshotRecording) {
+        Frames = Split.RecordFrames;
+    } else {
+        HudFramesCopy(&Frames);
+    }
+    
+    double Sum = 0.0;
+    double Max = 0.0;
+    for(int Index = 0; Index < HUD_HISTORY; ++Index) {
+        Sum += Frames.FrameTimes[Index];
+        Max = fmax(Max, Frames.FrameTimes[Index]);
+    }
+    double Last = Frames.FrameTimes[(Frames.FrameIndex + HUD_HISTORY - 1) % HUD_HISTORY];
+    
+    HudPrint(ColorWhite, "frame %5.2f ms avg %5.2f max %5.2f", Last, Sum / HUD_HISTORY, Max);
+    
+    // Graph of the last HUD_HISTORY frames, three lines tall, 33 ms at the
+    // top, with a line at 16.7 ms. Its mesh belongs to the render thread,
+    // so recorded snapshots go without.
+    
+    float Width = Scale.X * 32.0f;
+    float Height = Scale.Y * 3.0f;
+    float Left = Hud.Cursor.X - Scale.X / 2.0f;
+    float Bottom = Hud.Cursor.Y + Scale.Y / 2.0f - Height;
+    float* Vertex = Meshes[DEFAULT_MESH_HUD_GRAPH].Vertices;
+    
+    for(int Index = 0; Index + 1 < HUD_HISTORY && !SnapshotRecording; ++Index) {
+        for(int End = 0; End < 2; ++End) {
+            double Time = Frames.FrameTimes[(Frames.FrameIndex + Index + End) % HUD_HISTORY];
+            *Vertex++ = Left + Width * (Index + End) / (HUD_HISTORY - 1);
+            *Vertex++ = Bottom + Height * (float)fmin(Time / 33.3, 1.0);
+            *Vertex++ = Position.Z;
+        }
+    }
+    
+    float Target = Bottom + Height * 0.5f;
+    float TargetLine[] = {
+        Left, Target, Position.Z,
+        Left + Width, Target, Position.Z,
+    };
+    
+    if(!SnapshotRecording) {
+        memcpy(Vertex, TargetLine, sizeof(TargetLine));
+        MeshUpload(DEFAULT_MESH_HUD_GRAPH, HUD_HISTORY * 2);
+        DrawObject((v3){0.0f, 0.0f, 0.0f},
+                   (v3){1.0f, 1.0f, 1.0f},
+                   0.0f,
+                   ColorGreen,
+                   DEFAULT_MESH_HUD_GRAPH,
+                   0,
+                   DEFAULT_SHADER_POSITION,
+                   0,
+                   DEFAULT_INPUT_LAYOUT_POSITION,
+                   D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+    }
+    
+    Hud.Cursor.Y -= Height;
+    
+    HudPrint(ColorWhite, "frame p50 %.2f p99 %.2f p99.9 %.2f",
+             Frames.Percentiles[0], Frames.Percentiles[1], Frames.Percentiles[2]);
+    HudPrint(ColorWhite, "ticks/frame %d tick p99 %.2f ms", Frames.TicksPerFrame,
+             HistogramPercentile(&FrameStats.Ticks, 99.0));
+    HudPrint(ColorWhite, "draws %d binds %d states %d",
+             Frames.RenderStats.DrawCalls, Frames.RenderStats.TextureBinds, Frames.RenderStats.StateChanges);
+    HudPrint((Memory.Offset * 10 > Memory.Length * 9) ? ColorRed : ColorWhite,
+             "arena %zu/%zu KB", Memory.Offset / 1024, Memory.Length / 1024);
+    
+    for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+        HudPrint(ColorWhite, "%-15s %5ld %7.0f/s max %ld", Counters.Names[Counter],
+                 Counters.Tick[Counter], Counters.Rate[Counter], Counters.Stats.Max[Counter]);
+    }
+}
+
+void HudPrint(color Color, const char* Format, ...) {
+    
+    char Line[128];
+    va_list Arguments;
+    va_start(Arguments, Format);
+    vsnprintf(Line, sizeof(Line), Format, Arguments);
+    va_end(Arguments);
+    
+    TextBatchAdd(Hud.Cursor, Line, Color, Hud.Scale);
+    Hud.Cursor.Y -= Hud.Scale.Y;
+}
+
+void HudEnd() {
+    TextBatchFlush();
+}
+
+// Frame stats
+
+// The game's Update() and the engine's per tick work
+void RunTick() {
+    
+    int64_t Start = ClockNow();
+    int64_t End;
+    
+    ++TickCount;
+    Update();
+    
+    End = ClockNow();
+    double Milliseconds = NanosecondsToMilliseconds(End - Start);
+    HistogramAdd(&FrameStats.Ticks, Milliseconds);
+    
+    CountersTick();
+    if(Telemetry.File) TelemetryTick(Milliseconds);
+    AtomicAdd(&Hud.Ticks, 1);
+}
+
+// Call once per frame, before Draw(). The previous frame ends here.
+void FrameBegin() {
+    
+    int64_t Now = ClockNow();
+    
+    if(FrameStats.LastFrame) {
+        FrameStats.FrameMilliseconds = NanosecondsToMilliseconds(Now - FrameStats.LastFrame);
+        HistogramAdd(&FrameStats.Frames, FrameStats.FrameMilliseconds);
+    }
+    FrameStats.LastFrame = Now;
+    
+    BlackBoxFrame(Now);
+    HudFrame();
+}
+
+void HistogramAdd(histogram* Histogram, double Milliseconds) {
+    
+    if(Histogram->WindowSamples == HISTOGRAM_WINDOW_SAMPLES) {
+        Histogram->Window = (Histogram->Window + 1) % HISTOGRAM_WINDOWS;
+        Histogram->WindowSamples = 0;
+        memset(Histogram->Counts[Histogram->Window], 0, sizeof(Histogram->Counts[0]));
+    }
+    
+    // Values below HISTOGRAM_SUB_BUCKETS get a bucket each, above that
+    // every power of two is split in HISTOGRAM_SUB_BUCKETS
+    
+    uint64_t Value = (uint64_t)(Milliseconds * 1000.0);
+    int Shift = 0;
+    while(Value >> (Shift + 5)) ++Shift;
+    
+    int Bucket = (Value < HISTOGRAM_SUB_BUCKETS) ? (int)Value :
+        (Shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)(Value >> Shift) - HISTOGRAM_SUB_BUCKETS;
+    if(Bucket >= HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_BUCKETS) {
+        Bucket = HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_BUCKETS - 1;
+    }
+    
+    ++Histogram->Counts[Histogram->Window][Bucket];
+    ++Histogram->WindowSamples;
+}
+
+// In milliseconds, the middle of the bucket the percentile falls in
+double HistogramPercentile(histogram* Histogram, double Percentile) {
+    
+    uint64_t Total = 0;
+    for(int Window = 0; Window < HISTOGRAM_WINDOWS; ++Window) {
+        for(int Bucket = 0; Bucket < HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_BUCKETS; ++Bucket) {
+            Total += Histogram->Counts[Window][Bucket];
+        }
+    }
+    if(!Total) return 0.0;
+    
+    uint64_t Target = (uint64_t)ceil(Percentile / 100.0 * Total);
+    if(Target < 1) Target = 1;
+    
+    uint64_t Seen = 0;
+    for(int Bucket = 0; Bucket < HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_BUCKETS; ++Bucket) {
+        for(int Window = 0; Window < HISTOGRAM_WINDOWS; ++Window) {
+            Seen += Histogram->Counts[Window][Bucket];
+        }
+        if(Seen < Target) continue;
+        
+        int Magnitude = Bucket / HISTOGRAM_SUB_BUCKETS;
+        int Sub = Bucket % HISTOGRAM_SUB_BUCKETS;
+        if(Magnitude == 0) return (Sub + 0.5) / 1000.0;
+        double Width = (double)(1ull << (Magnitude - 1));
+        return ((HISTOGRAM_SUB_BUCKETS + Sub) * Width + Width / 2.0) / 1000.0;
+    }
+    
+    return 0.0;
+}
+
+// Ends the last frame at Now & starts the next one
+void BlackBoxFrame(int64_t Now) {
+    
+    if(BlackBox.FrameCount > 0) {
+        
+        long Last = BlackBox.FrameCount - 1;
+        blackBoxFrame* Frame = &BlackBox.Frames[Last % BLACKBOX_FRAMES];
+        Frame->End = Now;
+        Frame->Milliseconds = NanosecondsToMilliseconds(Now - Frame->Start);
+        
+        if(BlackBox.Budget > 0.0 && BlackBox.LongFrame < 0 && BlackBox.Dumps < BlackBox.MaxDumps &&
+           Frame->Milliseconds > BlackBox.Budget) {
+            BlackBox.LongFrame = Last;
+        }
+        
+        if(BlackBox.LongFrame >= 0 && Last >= BlackBox.LongFrame + BlackBox.After) {
+            long First = BlackBox.LongFrame - BlackBox.Before;
+            if(First < 0) First = 0;
+            if(First <= Last - BLACKBOX_FRAMES) First = Last - BLACKBOX_FRAMES + 1;
+            BlackBoxDump(First, Last);
+            BlackBox.LongFrame = -1;
+            ++BlackBox.Dumps;
+        }
+    }
+    
+    blackBoxFrame* Frame = &BlackBox.Frames[BlackBox.FrameCount % BLACKBOX_FRAMES];
+    *Frame = (blackBoxFrame){ .Start = Now };
+    for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+        Frame->Counters[Counter] = BlackBox.Totals[Counter];
+    }
+    ++BlackBox.FrameCount;
+}
+
+// Writes frames First to Last as a Chrome trace to longframe_<frame>.json:
+// one slice per frame, the counters per frame and the profiler zones of
+// every thread in between. Returns 0 on failure.
+int BlackBoxDump(long First, long Last) {
+    
+    char File[64];
+    snprintf(File, sizeof(File), "longframe_%06ld.json", BlackBox.LongFrame);
+    
+    FILE* Handle = fopen(File, "w");
+    if(!Handle) {
+        Debug("%s: can't write black box\n", File);
+        return 0;
+    }
+    
+    blackBoxFrame* Long = &BlackBox.Frames[BlackBox.LongFrame % BLACKBOX_FRAMES];
+    int64_t Base = BlackBox.Frames[First % BLACKBOX_FRAMES].Start;
+    
+    fprintf(Handle, "{\"traceEvents\":[\n");
+    fprintf(Handle, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1000,"
+            "\"args\":{\"name\":\"frames\"}}");
+    
+    for(long Index = First; Index <= Last; ++Index) {
+        
+        blackBoxFrame* Frame = &BlackBox.Frames[Index % BLACKBOX_FRAMES];
+        blackBoxFrame* Next = &BlackBox.Frames[(Index + 1) % BLACKBOX_FRAMES];
+        double Start = NanosecondsToMilliseconds(Frame->Start - Base) * 1000.0;
+        
+        fprintf(Handle, ",\n{\"name\":\"%s %ld\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1000}",
+                (Index == BlackBox.LongFrame) ? "LONG frame" : "frame", Index,
+                Start, Frame->Milliseconds * 1000.0);
+        
+        // The last frame's counts are still in the running totals
+        
+        fprintf(Handle, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", Start);
+        for(int Counter = 0; Counter < Counters.Count; ++Counter) {
+            long Until = (Index < Last) ? Next->Counters[Counter] : BlackBox.Totals[Counter];
+            fprintf(Handle, "%s\"%s\":%ld", Counter ? "," : "", Counters.Names[Counter],
+                    Until - Frame->Counters[Counter]);
+        }
+        fprintf(Handle, "}}");
+    }
+    
+#ifdef PROFILER
+    int64_t End = BlackBox.Frames[Last % BLACKBOX_FRAMES].End;
+    ProfileWriteEvents(Handle, Base, End, Base, 1);
+#endif
     
-    v3 RayOrigin = V3TransformCoord(&Origin, &InverseModel);
-    v3 RayDirection = V3TransformNormal(&Direction, &InverseModel);
+    fprintf(Handle, "\n]}\n");
     
-    V3Normalize(&RayDirection);
+    if(fclose(Handle) != 0) {
+        Debug("%s: write failed\n", File);
+        return 0;
+    }
     
-    triangle Triangle1 = {
-        .A = {
-            Mesh->Vertices[0], 
-            Mesh->Vertices[1], 
-            Mesh->Vertices[2]
-        },
-        .B = {
-            Mesh->Vertices[5], 
-            Mesh->Vertices[6], 
-            Mesh->Vertices[7]
-        },
-        .C = {
-            Mesh->Vertices[10], 
-            Mesh->Vertices[11], 
-            Mesh->Vertices[12]
-        }
+    Debug("black box: frame %ld took %.2f ms (budget %.2f), frames %ld-%ld in %s\n",
+          BlackBox.LongFrame, Long->Milliseconds, BlackBox.Budget, First, Last, File);
+    return 1;
+}
+
+// Render snapshots
+
+renderItem* SnapshotAdd(v3 Position, v3 Scale, float Rotation, color Color, int Mesh, int Texture,
+                        int Shader, int ConstantBuffer, int InputLayout, int PrimitiveTopology,
+                        float UOffset, float VOffset) {
+    
+    renderSnapshot* Snapshot = SnapshotRecording;
+    assert(Snapshot->Count < MAX_RENDER_ITEMS);
+    
+    renderItem* Item = &Snapshot->Items[Snapshot->Count++];
+    *Item = (renderItem){
+        .Position = Position,
+        .Scale = Scale,
+        .Rotation = Rotation,
+        .Color = Color,
+        .Mesh = Mesh,
+        .Texture = Texture,
+        .Shader = Shader,
+        .ConstantBuffer = ConstantBuffer,
+        .InputLayout = InputLayout,
+        .PrimitiveTopology = PrimitiveTopology,
+        .UOffset = UOffset,
+        .VOffset = VOffset,
+        .USize = Textures[Texture].USize,
+        .VSize = Textures[Texture].VSize,
     };
+    return Item;
+}
+
+// The uvs DrawObject() draws Texture with, the item's recorded ones while
+// drawing a snapshot. The simulation thread reads Textures[] while it
+// records, so the render thread leaves them alone.
+textureInfo SnapshotUvs(int Texture) {
+    if(SnapshotDrawing) {
+        renderItem* Item = SnapshotDrawing;
+        return (textureInfo){Item->UOffset, Item->VOffset, Item->USize, Item->VSize};
+    }
+    texture* Source = &Textures[Texture];
+    return (textureInfo){Source->UOffset, Source->VOffset, Source->USize, Source->VSize};
+}
+
+// On the render thread, in place of Draw()
+void SnapshotDraw(renderSnapshot* Snapshot) {
+    for(int Index = 0; Index < Snapshot->Count; ++Index) {
+        renderItem* Item = &Snapshot->Items[Index];
+        if(Item->Glyphs) {
+            memcpy(Meshes[DEFAULT_MESH_TEXT].Vertices, &Snapshot->TextVertices[Item->FirstGlyph * 6 * 5],
+                   Item->Glyphs * 6 * 5 * sizeof(float));
+            MeshUpload(DEFAULT_MESH_TEXT, Item->Glyphs * 6);
+        }
+        SnapshotDrawing = Item;
+        DrawObject(Item->Position, Item->Scale, Item->Rotation, Item->Color, Item->Mesh, Item->Texture,
+                   Item->Shader, Item->ConstantBuffer, Item->InputLayout, Item->PrimitiveTopology);
+    }
+    SnapshotDrawing = NULL;
+}
+
+// Moves Input() & Update() to a thread of their own. The calling thread
+// renders what SplitTake() returns instead of calling Draw().
+void SplitStart() {
+    MutexInit(&Split.Mutex);
+    ConditionInit(&Split.Published);
+    ConditionInit(&Split.Taken);
+    Split.Running = 1;
+    ThreadStart(&Split.Thread, SplitSimulate, NULL);
+}
+
+void SplitStop() {
+    MutexLock(&Split.Mutex);
+    AtomicStore64(&Split.Stop, 1);
+    ConditionBroadcast(&Split.Taken);
+    MutexUnlock(&Split.Mutex);
+    ThreadJoin(&Split.Thread);
+    Split.Running = 0;
+}
+
+void SplitSimulate(void* Data) {
     
-    triangle Triangle2 = {
-        .A = {
-            Mesh->Vertices[15], 
-            Mesh->Vertices[16], 
-            Mesh->Vertices[17]
-        },
-        .B = {
-            Mesh->Vertices[20], 
-            Mesh->Vertices[21], 
-            Mesh->Vertices[22]
-        },
-        .C = {
-            Mesh->Vertices[25], 
-            Mesh->Vertices[26], 
-            Mesh->Vertices[27]
+    int64_t Start = ClockNow();
+    
+    while(!AtomicLoad64(&Split.Stop)) {
+        
+        int64_t Now = ClockNow();
+        
+        // A late tick only takes the events from before its end, the
+        // ticks catching up after it get the rest
+        
+        int64_t Until = Now;
+        
+        if(Split.Paced) {
+            double Due = NanosecondsToMilliseconds(TicksToNanoseconds(Split.Ticks) - (Now - Start));
+            if(Due > 0.0) {
+                SleepMilliseconds(Due);
+                Now = ClockNow();
+                Until = Now;
+            } else {
+                Until = Start + TicksToNanoseconds(Split.Ticks + 1);
+            }
         }
-    };
+        
+        if(Split.SimulatedTime) {
+            SetTimer(&Timer, TicksToNanoseconds(Split.Ticks + 1));
+        } else {
+            UpdateTimer(&Timer);
+        }
+        
+        PROFILE_BEGIN("Tick");
+        
+        PROFILE_BEGIN("Input");
+        InputTick(Until);
+        Input();
+        PROFILE_END();
+        
+        PROFILE_BEGIN("Update");
+        RunTick();
+        PROFILE_END();
+        
+        PROFILE_BEGIN("Record");
+        renderSnapshot* Snapshot = &Split.Snapshots[Split.Writing];
+        Snapshot->Count = 0;
+        Snapshot->TextGlyphs = 0;
+        Snapshot->Tick = ++Split.Ticks;
+        Snapshot->InputTime = Now;
+        memcpy(Snapshot->Counters, Counters.Stats.Total, sizeof(Snapshot->Counters));
+        SnapshotRecording = Snapshot;
+        Draw();
+        SnapshotRecording = NULL;
+        PROFILE_END();
+        
+        SplitPublish();
+        
+        PROFILE_END();
+    }
+}
+
+void SplitPublish() {
     
-    if(RayTriangleIntersect(RayOrigin, RayDirection, &Triangle1) || RayTriangleIntersect(RayOrigin, RayDirection, &Triangle2)) {
-        Result = 1;
+    MutexLock(&Split.Mutex);
+    
+    if(Split.Fresh) ++Split.Skipped;
+    int Ready = Split.Ready;
+    Split.Ready = Split.Writing;
+    Split.Writing = Ready;
+    Split.Fresh = 1;
+    Split.RecordFrames = Split.Frames;
+    ConditionBroadcast(&Split.Published);
+    
+    while(Split.Lockstep && Split.Fresh && !Split.Stop) {
+        ConditionWait(&Split.Taken, &Split.Mutex);
     }
     
-    return Result;
+    MutexUnlock(&Split.Mutex);
+}
+
+// The newest snapshot, the last one again when there's nothing new and
+// not Wait. Hands the frames to the HUD & the snapshot's counters to the
+// black box.
+renderSnapshot* SplitTake(int Wait) {
+    
+    hudFrames Frames;
+    HudFramesCopy(&Frames);
+    
+    MutexLock(&Split.Mutex);
+    
+    Split.Frames = Frames;
+    
+    while(Wait && !Split.Fresh) {
+        ConditionWait(&Split.Published, &Split.Mutex);
+    }
+    
+    if(Split.Fresh) {
+        int Reading = Split.Reading;
+        Split.Reading = Split.Ready;
+        Split.Ready = Reading;
+        Split.Fresh = 0;
+        ConditionBroadcast(&Split.Taken);
+    }
+    
+    renderSnapshot* Snapshot = &Split.Snapshots[Split.Reading];
+    MutexUnlock(&Split.Mutex);
+    
+    BlackBox.Totals = Snapshot->Counters;
+    return Snapshot;
 }
 
+// Telemetry
 
-void DrawString(v3 Position, char* String, color Color, v3 Scale) {
+// Adds a column of the game's to the records, call before TelemetryOpen().
+// Returns the index for TelemetrySet().
+int TelemetryColumn(const char* Name) {
+    assert(!Telemetry.File);
+    assert(Telemetry.GameCount < MAX_TELEMETRY_COLUMNS);
+    Telemetry.GameNames[Telemetry.GameCount] = Name;
+    return Telemetry.GameCount++;
+}
+
+// Goes into this tick's record
+void TelemetrySet(int Column, long Value) {
+    assert(Column >= 0 && Column < Telemetry.GameCount);
+    Telemetry.GameValues[Column] = (int32_t)Value;
+}
+
+// Starts writing a record every tick: the tick, its update time & the last
+// frame's time in microseconds, the tick's counts of every counter and
+// the game's columns. Returns 0 when the file can't be written.
+int TelemetryOpen(const char* File) {
     
-    v3 NewPosition = Position;
+    Telemetry.File = fopen(File, "wb");
+    if(!Telemetry.File) {
+        Debug("%s: can't write telemetry\n", File);
+        return 0;
+    }
     
-    while(*String) {
+    telemetryHeader* Header = &Telemetry.Header;
+    Header->Magic = TELEMETRY_MAGIC;
+    Header->Version = TELEMETRY_VERSION;
+    
+    const char* Names[MAX_TELEMETRY_COLUMNS];
+    int Count = 0;
+    Names[Count++] = "tick";
+    Names[Count++] = "update_us";
+    Names[Count++] = "frame_us";
+    for(int Index = 0; Index < Counters.Count; ++Index) {
+        assert(Count < MAX_TELEMETRY_COLUMNS);
+        Names[Count++] = Counters.Names[Index];
+    }
+    for(int Index = 0; Index < Telemetry.GameCount; ++Index) {
+        assert(Count < MAX_TELEMETRY_COLUMNS);
+        Names[Count++] = Telemetry.GameNames[Index];
+    }
+    
+    Header->ColumnCount = Count;
+    for(int Index = 0; Index < Count; ++Index) {
+        snprintf(Header->Names[Index], TELEMETRY_NAME, "%s", Names[Index]);
+    }
+    Telemetry.RecordSize = Count * sizeof(int32_t);
+    
+    fwrite(Header, sizeof(*Header), 1, Telemetry.File);
+    fflush(Telemetry.File);
+    
+    MutexInit(&Telemetry.Mutex);
+    ConditionInit(&Telemetry.Ready);
+    ConditionInit(&Telemetry.Done);
+    ThreadStart(&Telemetry.Thread, TelemetryWriter, NULL);
+    return 1;
+}
+
+// Called by RunTick() when telemetry is on
+void TelemetryTick(double UpdateMilliseconds) {
+    
+    // Full, hand the buffer over if the writer's done with the other one
+    
+    if(Telemetry.Fill + Telemetry.RecordSize > TELEMETRY_BUFFER) {
+        MutexLock(&Telemetry.Mutex);
+        if(!Telemetry.Pending) {
+            Telemetry.Pending = Telemetry.Fill;
+            Telemetry.Active ^= 1;
+            Telemetry.Fill = 0;
+            ConditionBroadcast(&Telemetry.Ready);
+        }
+        MutexUnlock(&Telemetry.Mutex);
+    }
+    
+    ++Telemetry.Tick;
+    if(Telemetry.Fill + Telemetry.RecordSize > TELEMETRY_BUFFER) {
+        ++Telemetry.Dropped;
+        return;
+    }
+    
+    // Frames are the render thread's, under -split this thread has the
+    // copy it took on its last publish
+    
+    double FrameMilliseconds = Split.Running ? Split.RecordFrames.FrameMilliseconds :
+        FrameStats.FrameMilliseconds;
+    
+    int32_t* Record = (int32_t*)(Telemetry.Buffers[Telemetry.Active] + Telemetry.Fill);
+    *Record++ = (int32_t)Telemetry.Tick;
+    *Record++ = (int32_t)(UpdateMilliseconds * 1000.0);
+    *Record++ = (int32_t)(FrameMilliseconds * 1000.0);
+    for(int Index = 0; Index < Counters.Count; ++Index) {
+        *Record++ = (int32_t)Counters.Tick[Index];
+    }
+    for(int Index = 0; Index < Telemetry.GameCount; ++Index) {
+        *Record++ = Telemetry.GameValues[Index];
+    }
+    Telemetry.Fill += Telemetry.RecordSize;
+}
+
+// Writes what's buffered and waits for the writer to finish
+void TelemetryClose() {
+    
+    if(!Telemetry.File) return;
+    
+    MutexLock(&Telemetry.Mutex);
+    while(Telemetry.Pending) {
+        ConditionWait(&Telemetry.Done, &Telemetry.Mutex);
+    }
+    Telemetry.Pending = Telemetry.Fill;
+    Telemetry.Active ^= 1;
+    Telemetry.Stop = 1;
+    ConditionBroadcast(&Telemetry.Ready);
+    MutexUnlock(&Telemetry.Mutex);
+    
+    ThreadJoin(&Telemetry.Thread);
+    
+    if(fclose(Telemetry.File) != 0) Telemetry.Failed = 1;
+    Telemetry.File = NULL;
+    
+    Debug("telemetry: %ld ticks, %ld dropped%s\n", Telemetry.Tick, Telemetry.Dropped,
+          Telemetry.Failed ? ", write failed" : "");
+}
+
+// Writes the buffer that isn't being filled whenever one is handed over
+void TelemetryWriter(void* Data) {
+    
+    MutexLock(&Telemetry.Mutex);
+    for(;;) {
+        while(!Telemetry.Pending && !Telemetry.Stop) {
+            ConditionWait(&Telemetry.Ready, &Telemetry.Mutex);
+        }
         
-        Textures[DEFAULT_TEXTURE_FONT].UOffset = *String % 16;
-        Textures[DEFAULT_TEXTURE_FONT].VOffset = *String / 16;
+        int Size = Telemetry.Pending;
+        unsigned char* Buffer = Telemetry.Buffers[Telemetry.Active ^ 1];
+        MutexUnlock(&Telemetry.Mutex);
         
-        DrawObject(NewPosition, 
-                   Scale,
-                   0.0f,
-                   Color,
-                   DEFAULT_MESH_RECTANGLE_UV,
-                   DEFAULT_TEXTURE_FONT,
-                   DEFAULT_SHADER_POSITION_UV_ATLAS,
-                   0,
-                   DEFAULT_INPUT_LAYOUT_POSITION_UV,
-                   D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        ++String;
-        NewPosition.X += Scale.X;
+        if(Size && fwrite(Buffer, 1, Size, Telemetry.File) != (size_t)Size) {
+            Telemetry.Failed = 1;
+        }
+        
+        MutexLock(&Telemetry.Mutex);
+        Telemetry.Pending = 0;
+        ConditionBroadcast(&Telemetry.Done);
+        if(Telemetry.Stop) break;
+    }
+    MutexUnlock(&Telemetry.Mutex);
+}
+
+// Converts a telemetry file to CSV with the column names on the first
+// line. A record cut short by a killed run is left out. Returns 0 on failure.
+int TelemetryCsv(const char* File, const char* Csv) {
+    
+    FILE* Input = fopen(File, "rb");
+    if(!Input) {
+        Debug("%s: can't read telemetry\n", File);
+        return 0;
+    }
+    
+    telemetryHeader Header;
+    if(fread(&Header, sizeof(Header), 1, Input) != 1 ||
+       Header.Magic != TELEMETRY_MAGIC || Header.Version != TELEMETRY_VERSION ||
+       Header.ColumnCount == 0 || Header.ColumnCount > MAX_TELEMETRY_COLUMNS) {
+        Debug("%s: not a telemetry file\n", File);
+        fclose(Input);
+        return 0;
+    }
+    
+    FILE* Output = fopen(Csv, "w");
+    if(!Output) {
+        Debug("%s: can't write CSV\n", Csv);
+        fclose(Input);
+        return 0;
+    }
+    
+    for(uint32_t Column = 0; Column < Header.ColumnCount; ++Column) {
+        Header.Names[Column][TELEMETRY_NAME - 1] = 0;
+        fprintf(Output, "%s%s", Column ? "," : "", Header.Names[Column]);
+    }
+    fprintf(Output, "\n");
+    
+    long Records = 0;
+    int32_t Record[MAX_TELEMETRY_COLUMNS];
+    while(fread(Record, sizeof(int32_t), Header.ColumnCount, Input) == Header.ColumnCount) {
+        for(uint32_t Column = 0; Column < Header.ColumnCount; ++Column) {
+            fprintf(Output, "%s%d", Column ? "," : "", Record[Column]);
+        }
+        fprintf(Output, "\n");
+        ++Records;
     }
+    
+    fclose(Input);
+    if(fclose(Output) != 0) {
+        Debug("%s: write failed\n", Csv);
+        return 0;
+    }
+    
+    Debug("%s: %ld records, %u columns\n", Csv, Records, Header.ColumnCount);
+    return 1;
 }
 
+#ifndef HEADLESS
 int IsRepeat(LPARAM LParam) {
     return (HIWORD(LParam) & KF_REPEAT);
 }
 
+// -1 for keys the game doesn't use
+int KeyFromVirtualKey(WPARAM VirtualKey) {
+    switch(VirtualKey) {
+        case VK_UP: return UP;
+        case VK_DOWN: return DOWN;
+        case VK_RIGHT: return RIGHT;
+        case VK_LEFT: return LEFT;
+        case VK_SPACE: return SPACE;
+        case 'W': return W;
+        case 'A': return A;
+        case 'S': return S;
+        case 'D': return D;
+        case 'Q': return Q;
+        case 'E': return E;
+        case 'P': return P;
+        case 'M': return M;
+        case 'N': return N;
+        case 'R': return R;
+        case 'B': return B;
+        case 'C': return C;
+        case 'T': return T;
+        case 'H': return H;
+    }
+    return -1;
+}
+#endif
+
+// Clock
+
+// Monotonic nanoseconds. Kept as integers so long runs don't lose
+// precision the way a double millisecond count does.
+#ifndef HEADLESS
+int64_t ClockNow() {
+    
+    static int64_t Frequency;
+    if(!Frequency) {
+        LARGE_INTEGER Value;
+        QueryPerformanceFrequency(&Value);
+        Frequency = Value.QuadPart;
+    }
+    
+    LARGE_INTEGER Count;
+    QueryPerformanceCounter(&Count);
+    
+    // Split so Count * 10^9 can't overflow
+    int64_t Seconds = Count.QuadPart / Frequency;
+    int64_t Rest = Count.QuadPart % Frequency;
+    return Seconds * 1000000000 + Rest * 1000000000 / Frequency;
+}
+#else
+int64_t ClockNow() {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (int64_t)Time.tv_sec * 1000000000 + Time.tv_nsec;
+}
+#endif
+
+double NanosecondsToMilliseconds(int64_t Nanoseconds) {
+    return (double)Nanoseconds / 1000000.0;
+}
+
+int64_t MillisecondsToNanoseconds(double Milliseconds) {
+    return (int64_t)(Milliseconds * 1000000.0);
+}
+
+// Rounded per call rather than summed so simulated time doesn't drift. In
+// double, a float product is a millisecond out after a few hours of ticks.
+int64_t TicksToNanoseconds(int64_t Ticks) {
+    return (int64_t)((double)Ticks * (double)DeltaTime * 1000000000.0 + 0.5);
+}
+
 void StartTimer(timer* Timer) {
-    QueryPerformanceCounter(&Timer->StartingCount);
+    Timer->Start = ClockNow();
 }
 
 void UpdateTimer(timer* Timer) {
-    // get current tick
-    QueryPerformanceCounter(&Timer->EndingCount);
-    // get tick count
-    Timer->TotalCount.QuadPart = Timer->EndingCount.QuadPart - Timer->StartingCount.QuadPart;
-    // for precision
-    Timer->TotalCount.QuadPart *= 1000000;
-    // calculate elapsed milliseconds
-    Timer->ElapsedMilliSeconds = (double)(Timer->TotalCount.QuadPart / Timer->CountsPerSecond.QuadPart) / 1000;
-}
-
-DWORD InitTimer(timer* Timer) {
-    if(!QueryPerformanceFrequency(&Timer->CountsPerSecond)) {
-        return GetLastError();
-    }
+    SetTimer(Timer, ClockNow() - Timer->Start);
+}
+
+// For simulated time, ElapsedMilliSeconds is only ever derived
+void SetTimer(timer* Timer, int64_t Elapsed) {
+    Timer->Elapsed = Elapsed;
+    Timer->ElapsedMilliSeconds = NanosecondsToMilliseconds(Elapsed);
+}
+
+void InitTimer(timer* Timer) {
     StartTimer(Timer);
-    return 0;
+    SetTimer(Timer, 0);
 }
 
-int TimeElapsed(double* Time, double Elapsed) {
-    if(Timer.ElapsedMilliSeconds - *Time > Elapsed) {
-        *Time = Timer.ElapsedMilliSeconds;
-        return 1;
+// Rounded to the nearest tick, at least one
+int MillisecondsToTicks(double Milliseconds) {
+    int Ticks = (int)(Milliseconds / (DeltaTime * 1000.0) + 0.5);
+    return (Ticks > 0) ? Ticks : 1;
+}
+
+// Frame pacer
+
+// Hz 0 with PACER_FIXED is uncapped, with PACER_POWER_SAVING it's
+// PACER_POWER_SAVING_HZ
+void PacerInit(int Mode, double Hz) {
+    
+    if(Mode == PACER_POWER_SAVING && Hz <= 0.0) Hz = PACER_POWER_SAVING_HZ;
+    if(Hz <= 0.0) Mode = PACER_UNCAPPED;
+    
+    Pacer = (framePacer){
+        .Mode = Mode,
+        .Hz = Hz,
+        .Budget = (Hz > 0.0) ? (int64_t)(1000000000.0 / Hz + 0.5) : 0,
+        .Spin = MillisecondsToNanoseconds(PACER_MIN_SPIN_MILLISECONDS),
+    };
+}
+
+// Call once a frame after presenting, returns when the next one is due.
+// Sleeping alone wakes up late by the scheduler's granularity, so fixed
+// rates sleep until Spin before the deadline & yield in a loop after.
+void PacerWait() {
+    
+    if(Pacer.Mode == PACER_UNCAPPED) return;
+    
+    int64_t Now = ClockNow();
+    if(!Pacer.Deadline) Pacer.Deadline = Now;
+    Pacer.Deadline += Pacer.Budget;
+    ++Pacer.Frames;
+    
+    // A little late catches up over the next frames, a lot late starts
+    // over from now rather than running a burst of frames
+    
+    if(Now >= Pacer.Deadline) {
+        HistogramAdd(&Pacer.Lateness, NanosecondsToMilliseconds(Now - Pacer.Deadline));
+        if(Now - Pacer.Deadline > Pacer.Budget) {
+            Pacer.Deadline = Now;
+            ++Pacer.Missed;
+        }
+        return;
     }
-    return 0;
+    
+    int64_t Wake = Pacer.Deadline;
+    if(Pacer.Mode == PACER_FIXED) Wake -= Pacer.Spin;
+    
+#ifdef _WIN32
+    // Sleep() takes whole milliseconds & Sleep(0) only yields, the rest
+    // is left to the spin
+    if(Wake > Now) Wake = Now + MillisecondsToNanoseconds(floor(NanosecondsToMilliseconds(Wake - Now)));
+#endif
+    
+    if(Wake > Now) {
+        
+        SleepMilliseconds(NanosecondsToMilliseconds(Wake - Now));
+        
+        int64_t Error = ClockNow() - Wake;
+        if(Error < 0) Error = 0;
+        HistogramAdd(&Pacer.WakeError, NanosecondsToMilliseconds(Error));
+        PROFILE_VALUE("Wake error", NanosecondsToMilliseconds(Error));
+        
+        // Spin jumps up to the worst oversleep, eases back down slowly
+        
+        if(Pacer.Mode == PACER_FIXED) {
+            int64_t MinSpin = MillisecondsToNanoseconds(PACER_MIN_SPIN_MILLISECONDS);
+            int64_t MaxSpin = MillisecondsToNanoseconds(PACER_MAX_SPIN_MILLISECONDS);
+            if(Error > Pacer.Spin) {
+                Pacer.Spin = Error;
+            } else {
+                Pacer.Spin -= (Pacer.Spin - Error) / 64;
+            }
+            if(Pacer.Spin < MinSpin) Pacer.Spin = MinSpin;
+            if(Pacer.Spin > MaxSpin) Pacer.Spin = MaxSpin;
+        }
+    }
+    
+    // Yielding, not pausing, so on one core the other threads still run
+    
+    if(Pacer.Mode == PACER_FIXED) {
+        while(ClockNow() < Pacer.Deadline) ThreadYield();
+    }
+    
+    int64_t Late = ClockNow() - Pacer.Deadline;
+    HistogramAdd(&Pacer.Lateness, NanosecondsToMilliseconds((Late > 0) ? Late : 0));
+}
+
+void PacerPrint() {
+    Debug("pacer: %.1f Hz %s, wake error p50 %.3f p99 %.3f ms, late p50 %.3f p99 %.3f ms, "
+          "spin %.3f ms, %ld of %ld frames missed\n",
+          Pacer.Hz, (Pacer.Mode == PACER_FIXED) ? "fixed" : "power saving",
+          HistogramPercentile(&Pacer.WakeError, 50.0), HistogramPercentile(&Pacer.WakeError, 99.0),
+          HistogramPercentile(&Pacer.Lateness, 50.0), HistogramPercentile(&Pacer.Lateness, 99.0),
+          NanosecondsToMilliseconds(Pacer.Spin), Pacer.Missed, Pacer.Frames);
 }
 
 
@@ -1619,14 +7746,15 @@ void DebugMatrix(char* Message, matrix* M) {
 
 // Memory
 
-MemoryInit(size_t Size) {
+void MemoryInit(size_t Size) {
     MemoryBackend = malloc(Size);
     Memory.Data = (unsigned char*)MemoryBackend;
     Memory.Length = Size;
     Memory.Offset = 0;
 }
 
-void* MemoryAlloc(size_t Size) {
+// In parentheses so ALLOC_AUDIT's macro leaves the name alone
+void* (MemoryAlloc)(size_t Size) {
     void* Pointer = NULL;
     if(Memory.Offset+Size <= Memory.Length) {
         Pointer = &Memory.Data[Memory.Offset];
@@ -1641,6 +7769,87 @@ void* MemoryAlloc(size_t Size) {
     return Pointer;
 }
 
+// Allocation audit
+
+// Allocations are counted once Armed is set too
+void AllocAuditInit(int Trap) {
+    MutexInit(&AllocAudit.Mutex);
+    AllocAudit.Trap = Trap;
+    AllocAudit.Enabled = 1;
+}
+
+void AllocAuditRecord(size_t Size, const char* File, int Line) {
+    
+    if(!AllocAudit.Armed) return;
+    
+    if(AllocAudit.Trap) {
+        Debug("%s:%d: %zu byte allocation while the audit is armed\n", File, Line, Size);
+        abort();
+    }
+    
+    AtomicAdd(&AllocAudit.Allocations, 1);
+    
+    MutexLock(&AllocAudit.Mutex);
+    
+    allocSite* Site = NULL;
+    for(int Index = 0; Index < AllocAudit.SiteCount; ++Index) {
+        if(AllocAudit.Sites[Index].Line == Line && !strcmp(AllocAudit.Sites[Index].File, File)) {
+            Site = &AllocAudit.Sites[Index];
+            break;
+        }
+    }
+    if(!Site && AllocAudit.SiteCount < MAX_ALLOC_SITES) {
+        Site = &AllocAudit.Sites[AllocAudit.SiteCount++];
+        *Site = (allocSite){ .File = File, .Line = Line };
+    }
+    if(Site) {
+        ++Site->Count;
+        Site->Bytes += Size;
+    }
+    
+    MutexUnlock(&AllocAudit.Mutex);
+}
+
+// Every call site that allocated while armed
+void AllocAuditPrint() {
+    Debug("audited allocations: %ld, frees %ld\n", AllocAudit.Allocations, AllocAudit.Frees);
+    for(int Index = 0; Index < AllocAudit.SiteCount; ++Index) {
+        allocSite* Site = &AllocAudit.Sites[Index];
+        Debug("  %s:%d  %ld times, %ld bytes\n", Site->File, Site->Line, Site->Count, Site->Bytes);
+    }
+}
+
+#ifdef ALLOC_AUDIT
+
+// The real functions, in parentheses to get past the macros
+
+void* AuditMalloc(size_t Size, const char* File, int Line) {
+    AllocAuditRecord(Size, File, Line);
+    return (malloc)(Size);
+}
+
+void* AuditCalloc(size_t Count, size_t Size, const char* File, int Line) {
+    AllocAuditRecord(Count * Size, File, Line);
+    return (calloc)(Count, Size);
+}
+
+void* AuditRealloc(void* Pointer, size_t Size, const char* File, int Line) {
+    AllocAuditRecord(Size, File, Line);
+    return (realloc)(Pointer, Size);
+}
+
+void AuditFree(void* Pointer, const char* File, int Line) {
+    if(Pointer && AllocAudit.Armed) AtomicAdd(&AllocAudit.Frees, 1);
+    (free)(Pointer);
+}
+
+void* AuditMemoryAlloc(size_t Size, const char* File, int Line) {
+    AllocAuditRecord(Size, File, Line);
+    return (MemoryAlloc)(Size);
+}
+
+#endif
+
 // Maths
 
 float DegreesToRadians(float Degrees) {
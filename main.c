@@ -3,17 +3,26 @@
 #define MAX_ARRAY_LENGTH 4096
 #define INITIAL_ASTEROID_COUNT 3
 #define MAX_LIVES 5
+#define MAX_SAUCERS 64
 #define POINTS_PER_LARGE_ASTEROID 20
 #define POINTS_PER_MEDIUM_ASTEROID 50
 #define POINTS_PER_SMALL_ASTEROID 100
 #define POINTS_PER_MEDIUM_SAUCER 200
 #define POINTS_PER_SMALL_SAUCER 1000
 #define POINTS_TO_EXTRA_LIFE 2000
+#define MOVE_GRAIN 1024 // Entities per ParallelFor() range
+#define CONTACT_GRAIN 64 // Bullets per ParallelFor() range
+#define MAX_CONTACTS 4096 // Per tick
+#define SAUCER_SHOOTING_MS 2000.0
+#define SAUCER_SHOTS_PER_TURN 2
+#define SAUCER_PROXIMITY_LASER_MS 100.0
+#define SAUCER_RESPAWN_MS 5000.0
 
 // Types
 
 enum { BACKGROUND, PLAYER, BULLET, ASTEROID, SAUCER };
 enum { NONE, SMALL, MEDIUM, LARGE };
+enum { CONTACT_SAUCER, CONTACT_PLAYER, CONTACT_ASTEROID };
 
 typedef struct {
     v3 Position;
@@ -39,15 +48,10 @@ typedef struct {
     int Type;
     int Size;
     int Deleted;
-    // ms
-    double ShootingDelay;
-    double ShootingTimer;
-    double ProximityLaserDelay;
-    double ProximityLaserTimer;
-    double DirectionChangeDelay;
-    double DirectionChangeTimer;
-    double DeletedDelay;
-    double DeletedTimer;
+    u32 Id; // Unique, in creation order, set by AddEntityToArray()
+    int Script; // In SaucerScripts
+    int Shots; // Since the last turn, SaucerScript()'s loop counter
+    int64_t ProximityLaserReady; // Tick
 } entity;
 
 typedef struct {
@@ -57,6 +61,25 @@ typedef struct {
     int Index;
 } entityArray;
 
+// A bullet touching something, found by DetectBulletContacts()
+typedef struct {
+    u32 Bullet; // Id
+    int Kind;
+    int BulletIndex;
+    int TargetIndex;
+} contact;
+
+typedef struct {
+    contact Items[MAX_CONTACTS];
+    int Count;
+} contactList;
+
+// Entities spawned during a tick, added in one go by ApplySpawns()
+typedef struct {
+    entity Items[MAX_ARRAY_LENGTH];
+    int Count;
+} spawnBuffer;
+
 typedef struct {
     rectangle Rectangle;
     color Color;
@@ -69,19 +92,51 @@ typedef struct {
 int Pause;
 int TestingMode = 1;
 int DrawBoundingBoxes;
+int DrawHud;
+
+// Counters
+
+int CounterCollide;
+int CounterAsteroidTests;
+int CounterBoundingBoxes;
+int CounterAsteroidSpawns;
+int CounterBulletSpawns;
+int CounterDeletes;
+
+// Telemetry columns
+
+int TelemetryAsteroids;
+int TelemetryBullets;
+int TelemetrySaucers;
+int TelemetryScore;
+int TelemetrySaucersTime;
+int TelemetryBulletsTime;
+int TelemetryAsteroidsTime;
+u32 TelemetryLastScore;
 int MeshAsteroid;
 int AsteroidCount;
 int ExtraLifeCounter;
+int SaucerCount = 1;
 
 u32 Score;
+u32 NextEntityId;
 
 entity Player;
-entity Saucer;
+entity SaucerTemplate;
+entityArray Saucers;
+scheduler SaucerScripts;
+int SaucerDue[MAX_SAUCERS]; // Its script is due this tick
 entity Background;
 entityArray Bullets;
 entityArray Asteroids;
 entityArray HealthBar;
 
+// Each job worker's contacts, then all of them sorted
+contactList ContactLists[MAX_JOB_WORKERS];
+contact Contacts[MAX_CONTACTS];
+
+spawnBuffer AsteroidSpawns;
+
 // colors
 
 color ColorBackground =  {0.2f, 0.2f, 0.2f, 1.0f};
@@ -96,7 +151,10 @@ color ColorText =        {0.7f, 0.7f, 0.7f, 1.0f};
 
 v3 GetRandomPosition();
 v3 GetRandomPositionDistance(entity* Entity, float Distance);
-void SpawnSaucer();
+void AddSaucer();
+int SaucerScript(coroutine* Coroutine);
+void SpawnSaucer(entity* Saucer);
+void SaucerShoot(entity* Saucer);
 v3 GetScaleBySize(int Size);
 void CreateBullet(v3 Origin, v3 Direction, float Speed, color Color, int MaxLifetime, int Type);
 
@@ -104,6 +162,8 @@ boundingBox GetEntityBoundingBox(entity* Entity);
 
 entityArray NewEntityArray(int Capacity);
 void AddEntityToArray(entityArray* Array, entity* Entity);
+void AddEntitiesToArray(entityArray* Array, entity* Entities, int Count);
+void ApplySpawns();
 
 void DrawEntityBoundingBox(entity* Entity);
 void DrawEntity(entity* Entity);
@@ -177,6 +237,8 @@ v3 GetInaccurateDirection(v3 Direction, float Accuracy) {
 
 void SpawnAsteroid(v3* PositionCenter, int Size) {
     
+    CounterAdd(CounterAsteroidSpawns, 1);
+    
     v3 Scale = GetScaleBySize(Size);
     v3 Direction = V3GetRandomV2Direction();
     v3 Position = {0};
@@ -202,7 +264,10 @@ void SpawnAsteroid(v3* PositionCenter, int Size) {
         .Size = Size
     };
     
-    AddEntityToArray(&Asteroids, &Asteroid);
+    // Joins Asteroids at ApplySpawns(), counts as alive already
+    
+    assert(AsteroidSpawns.Count < MAX_ARRAY_LENGTH);
+    AsteroidSpawns.Items[AsteroidSpawns.Count++] = Asteroid;
     
     ++AsteroidCount;
 }
@@ -229,6 +294,7 @@ entity* EntityHitsAsteroid(entity* Entity) {
         
         if(Asteroid->Deleted || Entity->Deleted) continue;
         
+        CounterAdd(CounterAsteroidTests, 1);
         boundingBox EntityBox = GetEntityBoundingBox(Entity);
         boundingBox AsteroidBox = GetEntityBoundingBox(Asteroid);
         
@@ -274,7 +340,8 @@ entityArray NewEntityArray(int Capacity) {
 // Overrides elements starting from index 0 if overflowing
 
 void AddEntityToArray(entityArray* Array, entity* Entity) {
-    Array->Items[Array->Index++] = *Entity;
+    Array->Items[Array->Index] = *Entity;
+    Array->Items[Array->Index++].Id = ++NextEntityId;
     if(Array->Length < Array->Capacity) {
         ++Array->Length;
     }
@@ -283,8 +350,41 @@ void AddEntityToArray(entityArray* Array, entity* Entity) {
     }
 }
 
+// Same as AddEntityToArray() for each one, a copy per contiguous run
+void AddEntitiesToArray(entityArray* Array, entity* Entities, int Count) {
+    while(Count > 0) {
+        int Run = Array->Capacity - Array->Index;
+        if(Run > Count) Run = Count;
+        
+        entity* Items = &Array->Items[Array->Index];
+        memcpy(Items, Entities, Run * sizeof(entity));
+        for(int Index = 0; Index < Run; ++Index) {
+            Items[Index].Id = ++NextEntityId;
+        }
+        
+        Array->Length += Run;
+        if(Array->Length > Array->Capacity) Array->Length = Array->Capacity;
+        Array->Index += Run;
+        if(Array->Index >= Array->Capacity) Array->Index = 0;
+        
+        Entities += Run;
+        Count -= Run;
+    }
+}
+
+// Spawns are queued so nothing joins an array while a loop is going over
+// it. Called at the end of Update() and after spawning outside of it.
+// Deletes aren't queued, the Deleted flag already keeps entities out of
+// the rest of the tick and their slots get reused by later spawns.
+void ApplySpawns() {
+    AddEntitiesToArray(&Asteroids, AsteroidSpawns.Items, AsteroidSpawns.Count);
+    AsteroidSpawns.Count = 0;
+}
+
 boundingBox GetEntityBoundingBox(entity* Entity) {
     
+    CounterAdd(CounterBoundingBoxes, 1);
+    
     matrix Transform = MatrixIdentity();
     matrix Rotation = MatrixRotationZ(Entity->Rotation);
     matrix Scale = MatrixScale(Entity->Scale); 
@@ -450,6 +550,21 @@ void Init() {
     InitTimer(&Timer);
     EngineColorBackground = (color){0.12f, 0.12f, 0.12f, 1.0f};
     
+    CounterCollide = CounterRegister("collide");
+    CounterAsteroidTests = CounterRegister("asteroid tests");
+    CounterBoundingBoxes = CounterRegister("bounding boxes");
+    CounterAsteroidSpawns = CounterRegister("asteroid spawns");
+    CounterBulletSpawns = CounterRegister("bullet spawns");
+    CounterDeletes = CounterRegister("deletes");
+    
+    TelemetryAsteroids = TelemetryColumn("asteroids");
+    TelemetryBullets = TelemetryColumn("bullets");
+    TelemetrySaucers = TelemetryColumn("saucers");
+    TelemetryScore = TelemetryColumn("score delta");
+    TelemetrySaucersTime = TelemetryColumn("saucers_us");
+    TelemetryBulletsTime = TelemetryColumn("bullets_us");
+    TelemetryAsteroidsTime = TelemetryColumn("asteroids_us");
+    
     Bullets = NewEntityArray(100);
     Asteroids = NewEntityArray(100);
     
@@ -499,7 +614,7 @@ void Init() {
     
     Player = (entity){
         .Mesh = DEFAULT_MESH_RECTANGLE_UV,
-        .Shader = DEFAULT_SHADER_POSITION_UV,
+        .Shader = DEFAULT_SHADER_POSITION_UV_ATLAS,
         .InputLayout = DEFAULT_INPUT_LAYOUT_POSITION_UV,
         .PrimitiveTopology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
         .Texture = PlayerTexture,
@@ -515,9 +630,9 @@ void Init() {
     
     int SaucerTexture = CreateTexture("saucer.png", NULL, 0);
     
-    Saucer = (entity){
+    SaucerTemplate = (entity){
         .Mesh = DEFAULT_MESH_RECTANGLE_UV,
-        .Shader = DEFAULT_SHADER_POSITION_UV,
+        .Shader = DEFAULT_SHADER_POSITION_UV_ATLAS,
         .InputLayout = DEFAULT_INPUT_LAYOUT_POSITION_UV,
         .PrimitiveTopology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
         .Texture = SaucerTexture,
@@ -529,20 +644,19 @@ void Init() {
         .Accuracy = 0.1f,
         .Type = SAUCER,
         .Size = MEDIUM,
-        .DirectionChangeDelay = 4000.0f,
-        .DirectionChangeTimer = Timer.ElapsedMilliSeconds,
-        .ShootingDelay = 2000.0f,
-        .ShootingTimer = Timer.ElapsedMilliSeconds,
         .ShootingSpeed = 3.0f,
         .ProximityLaserSpeed = 15.0f,
-        .ProximityLaserDelay = 100.0f,
-        .ProximityLaserTimer = Timer.ElapsedMilliSeconds,
+        .ProximityLaserReady = TickCount + MillisecondsToTicks(SAUCER_PROXIMITY_LASER_MS),
         .ProximityLaserDistance = 3.0f,
-        .DeletedDelay = 5000.0f,
-        .DeletedTimer = Timer.ElapsedMilliSeconds,
         .Deleted = 1,
     };
     
+    Saucers = NewEntityArray(MAX_SAUCERS);
+    SchedulerInit(&SaucerScripts, MAX_SAUCERS + 1);
+    for(int Index = 0; Index < SaucerCount; ++Index) {
+        AddSaucer();
+    }
+    
     // Asteroids
     
     float AsteroidVertexData[] = {
@@ -563,13 +677,17 @@ void Init() {
                               3, 0, 0);
     
     SpawnAsteroids(INITIAL_ASTEROID_COUNT, NULL);
+    ApplySpawns();
 }
 
 void IncreaseDifficulty() {
-    if(Score > 5000.0f) {
-        Saucer.Accuracy = 0.8f;
-    } else if(Score > 10000.0f) {
-        Saucer.Accuracy = 1.0f;
+    for(int Index = 0; Index < Saucers.Length; ++Index) {
+        entity* Saucer = &Saucers.Items[Index];
+        if(Score > 5000.0f) {
+            Saucer->Accuracy = 0.8f;
+        } else if(Score > 10000.0f) {
+            Saucer->Accuracy = 1.0f;
+        }
     }
 }
 
@@ -577,24 +695,22 @@ void Input() {
     
     // Inputs
     
-    if(KeyPressed[P]) {
+    // KeyPressed counts this tick's presses, toggles flip once per press
+    
+    if(KeyPressed[P] % 2) {
         Pause = (Pause) ? 0 : 1;
-        KeyPressed[P] = 0;
     }
     
-    if(KeyPressed[B]) {
+    if(KeyPressed[B] % 2) {
         DrawBoundingBoxes = (DrawBoundingBoxes) ? 0 : 1;
-        KeyPressed[B] = 0;
     }
     
-    if(KeyPressed[R]) {
-        Camera.Position = (v3){0.0f, 0.0f, -14.5f};
-        KeyPressed[R] = 0;
+    if(KeyPressed[T] % 2) {
+        TestingMode = (TestingMode) ? 0 : 1;
     }
     
-    if(KeyPressed[T]) {
-        TestingMode = (TestingMode) ? 0 : 1;
-        KeyPressed[T] = 0;
+    if(KeyPressed[H] % 2) {
+        DrawHud = (DrawHud) ? 0 : 1;
     }
     
     // Direction
@@ -610,19 +726,19 @@ void Input() {
     if(KeyDown[UP]) Acceleration = Direction;
     AccelerateEntity(&Player, Acceleration, 4.0f);
     
-    // Shooting
+    // Shooting, a bullet for every tap
     
-    if(KeyPressed[SPACE]) {
-        KeyPressed[SPACE] = 0;
+    for(int Shot = 0; Shot < KeyPressed[SPACE]; ++Shot) {
         CreateBullet(Player.Position, Direction, 6.0f, ColorBullet, 120, PLAYER);
     }
 }
 
 void DeleteEntity(entity* Entity) {
+    CounterAdd(CounterDeletes, 1);
     Entity->Deleted = 1;
     switch(Entity->Type) {
         case SAUCER: {
-            Entity->DeletedTimer = Timer.ElapsedMilliSeconds;
+            CoroutineRestart(&SaucerScripts, Entity->Script, TickCount + MillisecondsToTicks(SAUCER_RESPAWN_MS));
         } break;
         case ASTEROID: {
             --AsteroidCount;
@@ -638,17 +754,70 @@ v3 GetRandomPositionDistance(entity* Entity, float Distance) {
     return Position;
 }
 
-void SpawnSaucer() {
-    Saucer.Velocity = V3GetRandomV2Direction();
-    Saucer.Position = GetRandomPositionDistance(&Player, 5.0f);
-    Saucer.Deleted = 0;
-    Saucer.Size = rand() % 2 + 1;
-    Saucer.Scale = GetScaleBySize(Saucer.Size);
+// Deleted, its script spawns it after SAUCER_RESPAWN_MS
+void AddSaucer() {
+    int Index = Saucers.Length;
+    AddEntityToArray(&Saucers, &SaucerTemplate);
+    Saucers.Items[Index].Script = CoroutineStart(&SaucerScripts, SaucerScript, Index,
+                                                 TickCount + MillisecondsToTicks(SAUCER_RESPAWN_MS));
+    assert(Saucers.Items[Index].Script);
+}
+
+// A saucer's life: spawns, then turns & shoots on the next tick, shoots
+// every SAUCER_SHOOTING_MS & turns again every SAUCER_SHOTS_PER_TURN
+// shots. DeleteEntity() starts it over after SAUCER_RESPAWN_MS.
+int SaucerScript(coroutine* Coroutine) {
+    
+    entity* Saucer = &Saucers.Items[Coroutine->Data];
+    
+    COROUTINE_BEGIN(Coroutine);
+    
+    SpawnSaucer(Saucer);
+    COROUTINE_WAIT(Coroutine, 1);
+    
+    for(;;) {
+        Saucer->Velocity = V3GetRandomV2Direction();
+        for(Saucer->Shots = 0; Saucer->Shots < SAUCER_SHOTS_PER_TURN; ++Saucer->Shots) {
+            SaucerShoot(Saucer);
+            COROUTINE_WAIT(Coroutine, MillisecondsToTicks(SAUCER_SHOOTING_MS));
+        }
+    }
+    
+    COROUTINE_END(Coroutine);
+}
+
+void SpawnSaucer(entity* Saucer) {
+    Saucer->Velocity = V3GetRandomV2Direction();
+    Saucer->Position = GetRandomPositionDistance(&Player, 5.0f);
+    Saucer->Deleted = 0;
+    Saucer->Size = rand() % 2 + 1;
+    Saucer->Scale = GetScaleBySize(Saucer->Size);
     // hack to squeeze the icon
-    Saucer.Scale.Y /= 2.0f;
+    Saucer->Scale.Y /= 2.0f;
+}
+
+// Small saucers aim at the player
+void SaucerShoot(entity* Saucer) {
+    
+    v3 Direction = V3GetRandomV2Direction();
+    
+    if(Saucer->Size == SMALL) {
+        Direction = V3GetDirection(Saucer->Position, Player.Position);
+        if(Saucer->Accuracy < 1.0f) {
+            Direction = GetInaccurateDirection(Direction, Saucer->Accuracy);
+        }
+    }
+    
+    CreateBullet(Saucer->Position,
+                 Direction,
+                 Saucer->ShootingSpeed,
+                 ColorYellow,
+                 120,
+                 SAUCER);
 }
 
 void CreateBullet(v3 Origin, v3 Direction, float Speed, color Color, int MaxLifetime, int Type) {
+    CounterAdd(CounterBulletSpawns, 1);
     entity Bullet = {
         .Mesh = DEFAULT_MESH_RECTANGLE,
         .Shader = DEFAULT_SHADER_POSITION,
@@ -670,6 +839,7 @@ int EntitiesCollide(entity* A, entity* B) {
     
     if(A->Deleted || B->Deleted) return 0;
     
+    CounterAdd(CounterCollide, 1);
     boundingBox ABox = GetEntityBoundingBox(A);
     boundingBox BBox = GetEntityBoundingBox(B);
     if(RectanglesIntersect(ABox.Rectangle, BBox.Rectangle)) {
@@ -678,6 +848,159 @@ int EntitiesCollide(entity* A, entity* B) {
     return 0;
 }
 
+int CountLiveEntities(entityArray* Array) {
+    int Count = 0;
+    for(int Index = 0; Index < Array->Length; ++Index) {
+        if(!Array->Items[Index].Deleted) ++Count;
+    }
+    return Count;
+}
+
+// Before the collision loops, in parallel: bullets age & move, asteroids
+// rotate & move. Each range only touches its own entities.
+
+void MoveBullets(int Begin, int End, void* Data) {
+    for(int Index = Begin; Index < End; ++Index) {
+        entity* Bullet = &Bullets.Items[Index];
+        if(Bullet->Deleted) continue;
+        if(++Bullet->Lifetime >= Bullet->MaxLifetime) {
+            Bullet->Deleted = 1;
+        } else {
+            MoveEntity(Bullet);
+        }
+    }
+}
+
+void MoveAsteroids(int Begin, int End, void* Data) {
+    for(int Index = Begin; Index < End; ++Index) {
+        entity* Asteroid = &Asteroids.Items[Index];
+        if(Asteroid->Deleted) continue;
+        RotateEntity(Asteroid, 0.2f);
+        MoveEntity(Asteroid);
+    }
+}
+
+// Bullets collide in two phases. Contacts are found in parallel, with
+// nothing changing, into each worker's list. Then they're sorted by
+// bullet id and applied on this thread, so the outcome is the same for any
+// number of workers.
+
+void ContactAdd(int Kind, entity* Bullet, int BulletIndex, int TargetIndex) {
+    contactList* List = &ContactLists[JobWorker];
+    assert(List->Count < MAX_CONTACTS);
+    List->Items[List->Count++] = (contact){
+        .Bullet = Bullet->Id,
+        .Kind = Kind,
+        .BulletIndex = BulletIndex,
+        .TargetIndex = TargetIndex,
+    };
+}
+
+void DetectBulletContacts(int Begin, int End, void* Data) {
+    for(int Index = Begin; Index < End; ++Index) {
+        entity* Bullet = &Bullets.Items[Index];
+        if(Bullet->Deleted) continue;
+        
+        if(Bullet->Type == PLAYER) {
+            for(int SaucerIndex = 0; SaucerIndex < Saucers.Length; ++SaucerIndex) {
+                entity* Saucer = &Saucers.Items[SaucerIndex];
+                if(EntitiesCollide(Bullet, Saucer)) {
+                    ContactAdd(CONTACT_SAUCER, Bullet, Index, SaucerIndex);
+                }
+            }
+        }
+        
+        if(Bullet->Type == SAUCER && EntitiesCollide(Bullet, &Player)) {
+            ContactAdd(CONTACT_PLAYER, Bullet, Index, 0);
+        }
+        
+        entity* Asteroid = EntityHitsAsteroid(Bullet);
+        if(Asteroid) {
+            ContactAdd(CONTACT_ASTEROID, Bullet, Index, (int)(Asteroid - Asteroids.Items));
+        }
+    }
+}
+
+int ContactCompare(const void* A, const void* B) {
+    const contact* X = A;
+    const contact* Y = B;
+    if(X->Bullet != Y->Bullet) return (X->Bullet > Y->Bullet) - (X->Bullet < Y->Bullet);
+    if(X->Kind != Y->Kind) return X->Kind - Y->Kind;
+    return X->TargetIndex - Y->TargetIndex;
+}
+
+void ResolveBulletContacts() {
+    
+    int Count = 0;
+    for(int Worker = 0; Worker < MAX_JOB_WORKERS; ++Worker) {
+        contactList* List = &ContactLists[Worker];
+        assert(Count + List->Count <= MAX_CONTACTS);
+        memcpy(&Contacts[Count], List->Items, List->Count * sizeof(contact));
+        Count += List->Count;
+        List->Count = 0;
+    }
+    
+    qsort(Contacts, Count, sizeof(contact), ContactCompare);
+    
+    for(int Index = 0; Index < Count; ++Index) {
+        contact* Contact = &Contacts[Index];
+        entity* Bullet = &Bullets.Items[Contact->BulletIndex];
+        
+        switch(Contact->Kind) {
+            case CONTACT_SAUCER: {
+                entity* Saucer = &Saucers.Items[Contact->TargetIndex];
+                if(Saucer->Deleted) break;
+                DeleteEntity(Saucer);
+                AddToScore(Saucer->Type, Saucer->Size);
+            } break;
+            case CONTACT_PLAYER: {
+                if(Bullet->Deleted) break;
+                DeleteEntity(Bullet);
+                ReduceLives(&Player);
+                // TODO: nicer kickback
+                v3 Kickback = Bullet->Velocity;
+                V3Normalize(&Kickback);
+                Kickback = V3MultiplyScalar(Kickback, 0.3f);
+                Player.Position = V3Add(Player.Position, Kickback);
+            } break;
+            case CONTACT_ASTEROID: {
+                if(Bullet->Deleted) break;
+                
+                // Destroyed by an earlier bullet, this one may still hit another
+                
+                entity* Asteroid = &Asteroids.Items[Contact->TargetIndex];
+                if(Asteroid->Deleted) {
+                    Asteroid = EntityHitsAsteroid(Bullet);
+                    if(!Asteroid) break;
+                }
+                
+                DeleteEntity(Bullet);
+                DeleteEntity(Asteroid);
+                if(Bullet->Type == PLAYER) {
+                    AddToScore(Asteroid->Type, Asteroid->Size);
+                }
+                
+                if(Asteroid->Size > SMALL) {
+                    SpawnAsteroids(INITIAL_ASTEROID_COUNT, Asteroid);
+                }
+            } break;
+        }
+    }
+}
+
+// Only when telemetry is on, counting costs a pass over every array.
+// Laps are ClockNow() before the saucers, bullets & asteroids & after.
+void RecordTelemetry(int64_t* Laps) {
+    TelemetrySet(TelemetryAsteroids, CountLiveEntities(&Asteroids));
+    TelemetrySet(TelemetryBullets, CountLiveEntities(&Bullets));
+    TelemetrySet(TelemetrySaucers, CountLiveEntities(&Saucers));
+    TelemetrySet(TelemetryScore, (long)Score - (long)TelemetryLastScore);
+    TelemetrySet(TelemetrySaucersTime, (long)((Laps[1] - Laps[0]) / 1000));
+    TelemetrySet(TelemetryBulletsTime, (long)((Laps[2] - Laps[1]) / 1000));
+    TelemetrySet(TelemetryAsteroidsTime, (long)((Laps[3] - Laps[2]) / 1000));
+    TelemetryLastScore = Score;
+}
+
 void Update() {
     
     if(Pause) return;
@@ -701,129 +1024,92 @@ void Update() {
     
     // Saucer
     
-    if(!Saucer.Deleted) {
-        
-        // change direction
-        
-        if(TimeElapsed(&Saucer.DirectionChangeTimer, Saucer.DirectionChangeDelay)) {
-            Saucer.Velocity = V3GetRandomV2Direction();
-        } 
-        
-        // shoot player
+    int64_t Laps[4];
+    Laps[0] = ClockNow();
+    
+    PROFILE_BEGIN("Saucer");
+    
+    // Only the scripts due this tick come out of the scheduler, they're
+    // resumed in saucer order below
+    
+    int Due[MAX_SAUCERS];
+    int DueCount = SchedulerAdvance(&SaucerScripts, TickCount, Due, ARRAYSIZE(Due));
+    memset(SaucerDue, 0, sizeof(SaucerDue));
+    for(int Index = 0; Index < DueCount; ++Index) {
+        SaucerDue[SaucerScripts.Coroutines[Due[Index]].Data] = 1;
+    }
+    
+    for(int Index = 0; Index < Saucers.Length; ++Index) {
+        entity* Saucer = &Saucers.Items[Index];
         
-        if(TimeElapsed(&Saucer.ShootingTimer, Saucer.ShootingDelay)) {
+        if(!Saucer->Deleted) {
             
-            v3 Direction = V3GetRandomV2Direction();
+            // turn & shoot player
             
-            if(Saucer.Size == SMALL) {
-                Direction = V3GetDirection(Saucer.Position, Player.Position);
-                if(Saucer.Accuracy < 1.0f) {
-                    Direction = GetInaccurateDirection(Direction, Saucer.Accuracy);
-                }
-            }
+            if(SaucerDue[Index]) CoroutineResume(&SaucerScripts, Saucer->Script);
             
-            CreateBullet(Saucer.Position,
-                         Direction,
-                         Saucer.ShootingSpeed,
-                         ColorYellow,
-                         120,
-                         SAUCER);
-        }
-        
-        // shoot asteroids
-        
-        entity* Asteroid = NULL;
-        
-        if(Asteroid = AsteroidNear(&Saucer, Saucer.ProximityLaserDistance)) {
+            // shoot asteroids
             
-            if(TimeElapsed(&Saucer.ProximityLaserTimer, Saucer.ProximityLaserDelay)) {
-                v3 Direction = V3GetDirection(Saucer.Position, Asteroid->Position);
-                CreateBullet(Saucer.Position, Direction, Saucer.ProximityLaserSpeed, ColorOrange, 30, SAUCER);
-            }
-        }
-        
-        MoveEntity(&Saucer);
-        
-        if(Asteroid = EntityHitsAsteroid(&Saucer)) {
-            DeleteEntity(Asteroid);
-            DeleteEntity(&Saucer);
-            if(Asteroid->Size > SMALL) {
-                SpawnAsteroids(INITIAL_ASTEROID_COUNT, Asteroid);
-            }
-        }
-        
-        if(EntitiesCollide(&Saucer, &Player)) {
-            DeleteEntity(&Saucer);
-            ReduceLives(&Player);
-        }
-        
-    }
-    
-    if(Saucer.Deleted && TimeElapsed(&Saucer.DeletedTimer, Saucer.DeletedDelay)) {
-        SpawnSaucer();
-    }
-    
-    // Bullets
-    
-    for(int Index = 0; Index < Bullets.Length; ++Index) {
-        entity* Bullet = &Bullets.Items[Index];
-        if(Bullet->Deleted) continue;
-        if(++Bullet->Lifetime >= Bullet->MaxLifetime) {
-            Bullet->Deleted = 1;
-        } else {
-            MoveEntity(Bullet);
             entity* Asteroid = NULL;
             
-            int PlayerCollides = 0;
-            
-            if(Bullet->Type == PLAYER) {
-                if(EntitiesCollide(Bullet, &Saucer)) {
-                    DeleteEntity(&Saucer);
-                    AddToScore(Saucer.Type, Saucer.Size);
+            if(Asteroid = AsteroidNear(Saucer, Saucer->ProximityLaserDistance)) {
+                
+                if(TickCount >= Saucer->ProximityLaserReady) {
+                    Saucer->ProximityLaserReady = TickCount + MillisecondsToTicks(SAUCER_PROXIMITY_LASER_MS);
+                    v3 Direction = V3GetDirection(Saucer->Position, Asteroid->Position);
+                    CreateBullet(Saucer->Position, Direction, Saucer->ProximityLaserSpeed, ColorOrange, 30, SAUCER);
                 }
             }
             
-            if(Bullet->Type == SAUCER) {
-                if(EntitiesCollide(Bullet, &Player)) {
-                    DeleteEntity(Bullet);
-                    ReduceLives(&Player);
-                    PlayerCollides = 1;
-                    // TODO: nicer kickback
-                    v3 Kickback = Bullet->Velocity;
-                    V3Normalize(&Kickback);
-                    Kickback = V3MultiplyScalar(Kickback, 0.3f);
-                    Player.Position = V3Add(Player.Position, Kickback);
-                }
-            }
+            MoveEntity(Saucer);
             
-            if(Asteroid = EntityHitsAsteroid(Bullet)) {
-                DeleteEntity(Bullet);
+            if(Asteroid = EntityHitsAsteroid(Saucer)) {
                 DeleteEntity(Asteroid);
-                if(Bullet->Type == PLAYER) {
-                    AddToScore(Asteroid->Type, Asteroid->Size);
-                }
-                
+                DeleteEntity(Saucer);
                 if(Asteroid->Size > SMALL) {
                     SpawnAsteroids(INITIAL_ASTEROID_COUNT, Asteroid);
                 }
-                
             }
+            
+            if(EntitiesCollide(Saucer, &Player)) {
+                DeleteEntity(Saucer);
+                ReduceLives(&Player);
+            }
+            
+        } else if(SaucerDue[Index]) {
+            
+            // respawn
+            
+            CoroutineResume(&SaucerScripts, Saucer->Script);
         }
     }
     
+    PROFILE_END();
+    Laps[1] = ClockNow();
+    
+    // Bullets
+    
+    PROFILE_BEGIN("Bullets");
+    
+    ParallelFor(Bullets.Length, MOVE_GRAIN, MoveBullets, NULL);
+    ParallelFor(Bullets.Length, CONTACT_GRAIN, DetectBulletContacts, NULL);
+    ResolveBulletContacts();
+    
+    PROFILE_END();
+    Laps[2] = ClockNow();
+    
     // Asteroids
     
+    PROFILE_BEGIN("Asteroids");
+    
     int PlayerCollides = 0;
     
+    ParallelFor(Asteroids.Length, MOVE_GRAIN, MoveAsteroids, NULL);
+    
     for(int Index = 0; Index < Asteroids.Length; ++Index) {
         entity* Asteroid = &Asteroids.Items[Index];
         if(Asteroid->Deleted) continue;
         
-        // Rotate & move
-        
-        RotateEntity(Asteroid, 0.2f);
-        MoveEntity(Asteroid);
-        
         // Player collision
         
         if(EntitiesCollide(&Player, Asteroid)) {
@@ -839,6 +1125,9 @@ void Update() {
         }
     }
     
+    PROFILE_END();
+    Laps[3] = ClockNow();
+    
     // Player.Color = (PlayerCollides ? ColorRed : ColorPlayer);
     
     if(AsteroidCount <= 0) {
@@ -851,6 +1140,9 @@ void Update() {
         IncreaseDifficulty();
     }
     
+    ApplySpawns();
+    
+    if(Telemetry.File) RecordTelemetry(Laps);
 };
 
 void DrawScore() {
@@ -868,13 +1160,283 @@ void DrawScore() {
                );
 }
 
+// Engine stats first, then live/allocated entities per array
+void DrawPerformanceHud() {
+    
+    HudBegin((v3){
+                 -(Background.Scale.X / 2.0f) + 0.5f,
+                 Background.Scale.Y / 2.0f - 2.0f,
+                 0.0f
+             },
+             (v3){0.22f, 0.35f, 1.0f});
+    
+    HudPrint(ColorText, "asteroids %d/%d", CountLiveEntities(&Asteroids), Asteroids.Length);
+    HudPrint(ColorText, "bullets %d/%d", CountLiveEntities(&Bullets), Bullets.Length);
+    HudPrint(ColorText, "saucers %d/%d", CountLiveEntities(&Saucers), Saucers.Length);
+    
+    HudEnd();
+}
+
 void Draw() {
+    PROFILE_BEGIN("Entities");
     DrawEntity(&Background);
     DrawEntity(&Player);
-    DrawEntity(&Saucer);
+    DrawEntityArray(&Saucers);
     DrawEntityArray(&Bullets);
     DrawEntityArray(&Asteroids);
     DrawEntityArray(&HealthBar);
+    PROFILE_END();
+    PROFILE_BEGIN("Score");
     DrawScore();
+    PROFILE_END();
+    if(DrawHud) DrawPerformanceHud();
+}
+
+
+// Benchmarks
+
+entity* BenchEntities;
+entityArray BenchArray;
+
+// Count asteroids spread over the playfield, the probe sits outside it
+// so searches walk the whole array
+void BenchSetupAsteroids(int Count) {
+    
+    if(!BenchEntities) BenchEntities = MemoryAlloc(BENCH_MAX_COUNT * sizeof(entity));
+    
+    srand(1);
+    Asteroids = (entityArray){
+        .Items = BenchEntities,
+        .Capacity = BENCH_MAX_COUNT,
+    };
+    for(int Index = 0; Index < Count; ++Index) {
+        SpawnAsteroid(NULL, rand() % 3 + 1);
+    }
+    ApplySpawns();
+}
+
+entity BenchProbe = {
+    .Mesh = DEFAULT_MESH_RECTANGLE_UV,
+    .Scale = {1.0f, 1.0f, 1.0f},
+    .Position = {100.0f, 100.0f, 0.0f},
+};
+
+void BenchGetEntityBoundingBox(int Count) {
+    for(int Index = 0; Index < Count; ++Index) {
+        boundingBox Box = GetEntityBoundingBox(&Asteroids.Items[Index]);
+        BENCH_KEEP(Box);
+    }
+}
+
+void BenchEntityHitsAsteroid(int Count) {
+    entity* Asteroid = EntityHitsAsteroid(&BenchProbe);
+    BENCH_KEEP(Asteroid);
+}
+
+void BenchAsteroidNear(int Count) {
+    entity* Asteroid = AsteroidNear(&BenchProbe, 1.0f);
+    BENCH_KEEP(Asteroid);
+}
+
+void BenchSetupArray(int Count) {
+    if(!BenchArray.Items) BenchArray = NewEntityArray(BENCH_MAX_COUNT);
+}
+
+void BenchAddEntityToArray(int Count) {
+    BenchArray.Index = 0;
+    BenchArray.Length = 0;
+    for(int Index = 0; Index < Count; ++Index) {
+        AddEntityToArray(&BenchArray, &BenchProbe);
+    }
+    BENCH_KEEP(BenchArray);
+}
+
+void Benchmark() {
+    BenchRun("GetEntityBoundingBox", BenchSetupAsteroids, BenchGetEntityBoundingBox);
+    BenchRun("EntityHitsAsteroid", BenchSetupAsteroids, BenchEntityHitsAsteroid);
+    BenchRun("AsteroidNear", BenchSetupAsteroids, BenchAsteroidNear);
+    BenchRun("AddEntityToArray", BenchSetupArray, BenchAddEntityToArray);
+}
+
+// Moves 10k to 1M asteroids with 1 worker up to -jobs workers. Every
+// worker count has to leave them exactly where one worker does.
+void BenchmarkJobs() {
+    
+    int Counts[] = {10000, 100000, 1000000};
+    int MaxCount = 1000000;
+    int MaxWorkers = Jobs.WorkerCount;
+    int Ticks = 10;
+    
+    entity* Start = malloc(MaxCount * sizeof(entity));
+    entity* Serial = malloc(MaxCount * sizeof(entity));
+    entity* Items = malloc(MaxCount * sizeof(entity));
+    assert(Start && Serial && Items);
+    
+    srand(1);
+    for(int Index = 0; Index < MaxCount; ++Index) {
+        Start[Index] = (entity){
+            .Position = {
+                (GetRandomZeroToOne() - 0.5f) * Background.Scale.X,
+                (GetRandomZeroToOne() - 0.5f) * Background.Scale.Y,
+                0.0f
+            },
+            .Velocity = V3GetRandomV2Direction(),
+            .Speed = 1.0f + GetRandomZeroToOne() * 4.0f,
+            .Rotation = GetRandomZeroToOne() * 360.0f,
+            .Scale = {1.0f, 1.0f, 1.0f},
+            .Type = ASTEROID,
+        };
+    }
+    
+    entityArray Saved = Asteroids;
+    
+    for(int CountIndex = 0; CountIndex < ARRAYSIZE(Counts); ++CountIndex) {
+        
+        int Count = Counts[CountIndex];
+        double Baseline = 0.0;
+        
+        for(int Workers = 1; Workers <= MaxWorkers; Workers = (Workers * 2 > MaxWorkers && Workers < MaxWorkers) ? MaxWorkers : Workers * 2) {
+            
+            JobsShutdown();
+            JobsInit(Workers);
+            
+            memcpy(Items, Start, Count * sizeof(entity));
+            Asteroids = (entityArray){
+                .Items = Items,
+                .Length = Count,
+                .Capacity = Count,
+            };
+            
+            int64_t Begin = ClockNow();
+            int64_t End;
+            for(int Tick = 0; Tick < Ticks; ++Tick) {
+                ParallelFor(Count, MOVE_GRAIN, MoveAsteroids, NULL);
+            }
+            End = ClockNow();
+            
+            double Milliseconds = NanosecondsToMilliseconds(End - Begin) / Ticks;
+            if(Workers == 1) {
+                Baseline = Milliseconds;
+                memcpy(Serial, Items, Count * sizeof(entity));
+            }
+            
+            Debug("MoveAsteroids %8d  %2d workers  %8.3f ms/tick  %5.2fx  %s\n",
+                  Count, Workers, Milliseconds, Baseline / Milliseconds,
+                  memcmp(Serial, Items, Count * sizeof(entity)) ? "DIFFERENT" : "identical");
+        }
+    }
+    
+    JobsShutdown();
+    JobsInit(MaxWorkers);
+    Asteroids = Saved;
+    
+    free(Start);
+    free(Serial);
+    free(Items);
+}
+
+// Scenarios
+
+#ifdef HEADLESS
+
+typedef struct {
+    char* Name;
+    int Asteroids;
+    int Saucers;
+    float ShotsPerSecond;
+    int Ticks;
+} scenario;
+
+scenario Scenarios[] = {
+    { .Name = "baseline",       .Asteroids = 3,   .Saucers = 1,  .ShotsPerSecond = 0.0f,  .Ticks = 600 },
+    { .Name = "asteroid_field", .Asteroids = 200, .Saucers = 1,  .ShotsPerSecond = 0.0f,  .Ticks = 600 },
+    { .Name = "bullet_spam",    .Asteroids = 3,   .Saucers = 1,  .ShotsPerSecond = 30.0f, .Ticks = 600 },
+    { .Name = "saucer_swarm",   .Asteroids = 3,   .Saucers = 32, .ShotsPerSecond = 0.0f,  .Ticks = 600 },
+    { .Name = "stress",         .Asteroids = 200, .Saucers = 32, .ShotsPerSecond = 60.0f, .Ticks = 600 },
+};
+
+scenario* CurrentScenario;
+u32 ScriptState;
+float ScriptShots;
+
+// Own generator so the script doesn't change the game's rand() sequence
+u32 ScriptRandom() {
+    ScriptState = ScriptState * 1664525u + 1013904223u;
+    return ScriptState >> 8;
+}
+
+// Turns and thrusts in half second bursts, fires at the scenario's rate
+void ScenarioScript(int Tick) {
+    
+    if(Tick % 30 == 0) {
+        int Turn = ScriptRandom() % 3;
+        int Thrust = ScriptRandom() % 2;
+        InputPush((inputEvent){ .Type = (Turn == 1) ? INPUT_KEY_DOWN : INPUT_KEY_UP, .Key = LEFT });
+        InputPush((inputEvent){ .Type = (Turn == 2) ? INPUT_KEY_DOWN : INPUT_KEY_UP, .Key = RIGHT });
+        InputPush((inputEvent){ .Type = Thrust ? INPUT_KEY_DOWN : INPUT_KEY_UP, .Key = UP });
+    }
+    
+    ScriptShots += CurrentScenario->ShotsPerSecond * DeltaTime;
+    if(ScriptShots >= 1.0f) {
+        ScriptShots -= 1.0f;
+        InputPush((inputEvent){ .Type = INPUT_KEY_DOWN, .Key = SPACE });
+        InputPush((inputEvent){ .Type = INPUT_KEY_UP, .Key = SPACE });
+    }
+    
+    ScenarioEntities = 1 + CountLiveEntities(&Asteroids) + CountLiveEntities(&Bullets) +
+        CountLiveEntities(&Saucers);
+}
+
+// Same start as Init() with the scenario's counts and bigger arrays
+void ScenarioSetup(scenario* Scenario) {
+    
+    static entityArray ScenarioBullets;
+    static entityArray ScenarioAsteroids;
+    
+    if(!ScenarioBullets.Items) {
+        ScenarioBullets = NewEntityArray(MAX_ARRAY_LENGTH);
+        ScenarioAsteroids = NewEntityArray(MAX_ARRAY_LENGTH);
+    }
+    
+    srand(1);
+    ScriptState = 1;
+    ScriptShots = 0.0f;
+    CurrentScenario = Scenario;
+    
+    InputReset();
+    SetTimer(&Timer, 0);
+    TickCount = 0;
+    SchedulerReset(&SaucerScripts, 0);
+    
+    Score = 0;
+    ExtraLifeCounter = 0;
+    AsteroidCount = 0;
+    
+    Player.Position = (v3){0};
+    Player.Velocity = (v3){0};
+    Player.Rotation = 0.0f;
+    
+    Bullets = ScenarioBullets;
+    Asteroids = ScenarioAsteroids;
+    
+    assert(Scenario->Saucers <= MAX_SAUCERS);
+    Saucers.Length = 0;
+    Saucers.Index = 0;
+    for(int Index = 0; Index < Scenario->Saucers; ++Index) {
+        AddSaucer();
+    }
+    
+    SpawnAsteroids(Scenario->Asteroids, NULL);
+    ApplySpawns();
+}
+
+void RunScenarios(char* Filter) {
+    for(int Index = 0; Index < ARRAYSIZE(Scenarios); ++Index) {
+        scenario* Scenario = &Scenarios[Index];
+        if(!strstr(Scenario->Name, Filter)) continue;
+        ScenarioSetup(Scenario);
+        ScenarioRun(Scenario->Name, Scenario->Ticks, ScenarioScript);
+    }
 }
 
+#endif